@@ -0,0 +1,392 @@
+// Schwartz Liran
+//
+// afu_bench : microbenchmarks for the collections, dispatchers, pub/sub and events.
+// Every run prints one JSON object per line :
+//	{"bench":"dispatcher_post","producers":1,"messages":200000,"seconds":0.041,
+//	 "msgs_per_sec":4878048.8,"p50_ns":180,"p99_ns":2100,"p999_ns":9800,"max_ns":41000}
+// Latencies are per message (enqueue / write to callback) or per operation.
+//
+//	afu_bench [filter] [--messages N]
+// runs the benchmarks whose name contains filter, N messages each (default 200000).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utils/collection.hpp>
+#include <utils/event.hpp>
+#include <utils/instrumentation.hpp>
+#include <utils/mpmc_queue.hpp>
+#include <subscription/dispatcher.hpp>
+#include <subscription/subscription.hpp>
+
+namespace
+{
+	using bench_clock = std::chrono::steady_clock;
+
+	// keeps single thread loops from being optimized away
+	volatile uint64_t g_sink = 0;
+
+	struct bench_result
+	{
+		std::string bench;
+		const char* scale_name;  // what scale counts : threads, dispatchers, handlers
+		size_t scale;
+		uint64_t messages;
+		double seconds;
+		afu::histogram_snapshot latency;
+	};
+
+	struct bench_options
+	{
+		std::string filter;
+		uint64_t messages = 200000;
+	};
+
+	void report(const bench_result& _result)
+	{
+		std::printf("{\"bench\":\"%s\",\"%s\":%zu,\"messages\":%llu,\"seconds\":%.6f,\"msgs_per_sec\":%.1f,"
+			"\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+			_result.bench.c_str(),
+			_result.scale_name,
+			_result.scale,
+			static_cast<unsigned long long>(_result.messages),
+			_result.seconds,
+			_result.seconds > 0 ? static_cast<double>(_result.messages) / _result.seconds : 0.0,
+			static_cast<unsigned long long>(_result.latency.percentile(50)),
+			static_cast<unsigned long long>(_result.latency.percentile(99)),
+			static_cast<unsigned long long>(_result.latency.percentile(99.9)),
+			static_cast<unsigned long long>(_result.latency.max));
+		std::fflush(stdout);
+	}
+
+	double seconds_since(bench_clock::time_point _start)
+	{
+		return std::chrono::duration<double>(bench_clock::now() - _start).count();
+	}
+
+	void wait_for_count(const std::atomic<uint64_t>& _count, uint64_t _target)
+	{
+		while (_count.load(std::memory_order_acquire) < _target)
+			std::this_thread::yield();
+	}
+
+	// 1, 2, 4 ... up to the hardware threads (at least 2, at most 16)
+	std::vector<size_t> thread_counts()
+	{
+		size_t limit = std::max<size_t>(2, std::min<size_t>(16, std::thread::hardware_concurrency()));
+		std::vector<size_t> counts;
+		for (size_t count = 1; count <= limit; count *= 2)
+			counts.push_back(count);
+
+		return counts;
+	}
+
+
+	// Single thread push + pop, latency is the average of a 64 operation round
+	void bench_cyclic_buffer(const bench_options& _options)
+	{
+		constexpr size_t ROUND = 64;
+		afu::cyclicBuffer<uint64_t> buffer(ROUND);
+		afu::latency_histogram latency;
+
+		auto start = bench_clock::now();
+		for (uint64_t done = 0; done < _options.messages; done += ROUND)
+		{
+			auto round_start = afu::instrument_now_ns();
+			for (size_t i = 0; i < ROUND; ++i)
+				buffer.push(done + i);
+
+			uint64_t sink = 0;
+			for (size_t i = 0; i < ROUND; ++i)
+				sink += buffer.pop();
+
+			latency.record((afu::instrument_now_ns() - round_start) / (2 * ROUND));
+			g_sink = sink;
+		}
+
+		report({ "cyclic_buffer_push_pop", "threads", 1, _options.messages, seconds_since(start), latency.snapshot() });
+	}
+
+	// One producer thread, one consumer thread, latency is push to pop
+	void bench_spsc_ring(const bench_options& _options)
+	{
+		afu::spsc_ring<uint64_t> ring(1024);
+		afu::latency_histogram latency;
+
+		auto start = bench_clock::now();
+		std::thread consumer([&]()
+			{
+				uint64_t batch[64];
+				uint64_t received = 0;
+				while (received < _options.messages)
+				{
+					auto count = ring.pop_n(batch, 64);
+					if (count == 0)
+					{
+						std::this_thread::yield();
+						continue;
+					}
+
+					auto now = afu::instrument_now_ns();
+					for (size_t i = 0; i < count; ++i)
+						latency.record(now - batch[i]);
+
+					received += count;
+				}
+			});
+
+		for (uint64_t i = 0; i < _options.messages; ++i)
+		{
+			while (!ring.try_push(afu::instrument_now_ns()))
+				std::this_thread::yield();
+		}
+		consumer.join();
+
+		report({ "spsc_ring", "threads", 2, _options.messages, seconds_since(start), latency.snapshot() });
+	}
+
+	// _producers threads push timestamps, one consumer pops them
+	template<typename Push, typename Pop>
+	bench_result run_producers(const char* _name, size_t _producers, uint64_t _messages, Push&& _push, Pop&& _pop)
+	{
+		afu::latency_histogram latency;
+		auto per_producer = _messages / _producers;
+		auto total = per_producer * _producers;
+
+		auto start = bench_clock::now();
+		std::thread consumer([&]()
+			{
+				for (uint64_t received = 0; received < total; ++received)
+				{
+					auto pushed = _pop();
+					latency.record(afu::instrument_now_ns() - pushed);
+				}
+			});
+
+		std::vector<std::thread> producers;
+		for (size_t p = 0; p < _producers; ++p)
+		{
+			producers.emplace_back([&]()
+				{
+					for (uint64_t i = 0; i < per_producer; ++i)
+						_push(afu::instrument_now_ns());
+				});
+		}
+
+		for (auto& producer : producers)
+			producer.join();
+
+		consumer.join();
+		return { _name, "producers", _producers, total, seconds_since(start), latency.snapshot() };
+	}
+
+	void bench_thread_safe_queue(const bench_options& _options)
+	{
+		for (auto producers : thread_counts())
+		{
+			afu::threadSafeQueue<uint64_t> queue;
+			report(run_producers("thread_safe_queue", producers, _options.messages,
+				[&](uint64_t _value) { queue.push(_value); },
+				[&]() { return queue.pop(); }));
+		}
+	}
+
+	void bench_mpmc_queue(const bench_options& _options)
+	{
+		for (auto producers : thread_counts())
+		{
+			afu::mpmc_queue<uint64_t> queue(4096);
+			report(run_producers("mpmc_queue", producers, _options.messages,
+				[&](uint64_t _value) { queue.push(_value); },
+				[&]() { uint64_t value = 0; queue.pop(value); return value; }));
+		}
+	}
+
+
+	// One action in flight at a time : wake-up plus execution latency of an idle dispatcher
+	void bench_dispatcher_round_trip(const bench_options& _options)
+	{
+		afu::dispatcher disp;
+		disp.start();
+
+		afu::latency_histogram latency;
+		std::atomic<uint64_t> executed{ 0 };
+		auto messages = std::max<uint64_t>(1000, _options.messages / 10);
+
+		auto start = bench_clock::now();
+		for (uint64_t i = 0; i < messages; ++i)
+		{
+			auto posted = afu::instrument_now_ns();
+			disp.post([&, posted]()
+				{
+					latency.record(afu::instrument_now_ns() - posted);
+					executed.fetch_add(1, std::memory_order_release);
+				});
+			wait_for_count(executed, i + 1);
+		}
+
+		report({ "dispatcher_round_trip", "producers", 1, messages, seconds_since(start), latency.snapshot() });
+		disp.stop();
+	}
+
+	// _producers threads post as fast as they can, latency includes queueing
+	void bench_dispatcher_post(const bench_options& _options)
+	{
+		for (auto producers : thread_counts())
+		{
+			afu::dispatcher disp;
+			disp.start();
+
+			afu::latency_histogram latency;
+			std::atomic<uint64_t> executed{ 0 };
+			auto per_producer = _options.messages / producers;
+			auto total = per_producer * producers;
+
+			auto start = bench_clock::now();
+			std::vector<std::thread> threads;
+			for (size_t p = 0; p < producers; ++p)
+			{
+				threads.emplace_back([&]()
+					{
+						for (uint64_t i = 0; i < per_producer; ++i)
+						{
+							auto posted = afu::instrument_now_ns();
+							disp.post([&, posted]()
+								{
+									latency.record(afu::instrument_now_ns() - posted);
+									executed.fetch_add(1, std::memory_order_release);
+								});
+						}
+					});
+			}
+
+			for (auto& thread : threads)
+				thread.join();
+
+			wait_for_count(executed, total);
+			report({ "dispatcher_post", "producers", producers, total, seconds_since(start), latency.snapshot() });
+			disp.stop();
+		}
+	}
+
+
+	struct bench_sample
+	{
+		uint64_t written_ns;
+		uint64_t sequence;
+	};
+
+	// write() to end of callback on every subscribed dispatcher, messages counts deliveries
+	void bench_subscriber(const bench_options& _options)
+	{
+		for (size_t dispatchers = 1; dispatchers <= 64; dispatchers *= 2)
+		{
+			std::vector<std::unique_ptr<afu::dispatcher>> disps;
+			for (size_t i = 0; i < dispatchers; ++i)
+			{
+				disps.push_back(std::make_unique<afu::dispatcher>());
+				disps.back()->start();
+			}
+
+			afu::latency_histogram latency;
+			std::atomic<uint64_t> delivered{ 0 };
+			auto sub = std::make_shared<afu::subscriber>(sizeof(bench_sample));
+			for (auto& disp : disps)
+			{
+				sub->subscribe(disp.get(), [&](const std::shared_ptr<afu::subscription_data>& _data)
+					{
+						latency.record(afu::instrument_now_ns() - _data->read<bench_sample>().written_ns);
+						delivered.fetch_add(1, std::memory_order_release);
+					});
+			}
+
+			auto writes = std::max<uint64_t>(1000, _options.messages / dispatchers);
+			auto start = bench_clock::now();
+			for (uint64_t i = 0; i < writes; ++i)
+				sub->write(bench_sample{ afu::instrument_now_ns(), i });
+
+			wait_for_count(delivered, writes * dispatchers);
+			report({ "subscriber_write", "dispatchers", dispatchers, writes * dispatchers, seconds_since(start), latency.snapshot() });
+
+			for (auto& disp : disps)
+				disp->stop();
+		}
+	}
+
+
+	// Cost of one invoke() with 1, 16 and 256 handlers registered
+	void bench_smart_event(const bench_options& _options)
+	{
+		constexpr size_t ROUND = 16;
+		for (size_t handlers : { 1, 16, 256 })
+		{
+			afu::smart_event<int> event;
+			std::vector<uint64_t> counters(handlers, 0);
+			for (size_t h = 0; h < handlers; ++h)
+				event += [&counters, h](int _value) { counters[h] += static_cast<uint64_t>(_value); };
+
+			afu::latency_histogram latency;
+			auto invokes = std::max<uint64_t>(ROUND * 64, _options.messages / handlers);
+
+			auto start = bench_clock::now();
+			for (uint64_t done = 0; done < invokes; done += ROUND)
+			{
+				auto round_start = afu::instrument_now_ns();
+				for (size_t i = 0; i < ROUND; ++i)
+					event.invoke(1);
+
+				latency.record((afu::instrument_now_ns() - round_start) / ROUND);
+			}
+
+			report({ "smart_event_invoke", "handlers", handlers, invokes, seconds_since(start), latency.snapshot() });
+		}
+	}
+
+
+	struct bench_entry
+	{
+		const char* name;
+		void (*run)(const bench_options&);
+	};
+
+	const bench_entry BENCHMARKS[] =
+	{
+		{ "cyclic_buffer_push_pop", bench_cyclic_buffer },
+		{ "spsc_ring", bench_spsc_ring },
+		{ "thread_safe_queue", bench_thread_safe_queue },
+		{ "mpmc_queue", bench_mpmc_queue },
+		{ "dispatcher_round_trip", bench_dispatcher_round_trip },
+		{ "dispatcher_post", bench_dispatcher_post },
+		{ "subscriber_write", bench_subscriber },
+		{ "smart_event_invoke", bench_smart_event },
+	};
+}
+
+
+int main(int argc, char** argv)
+{
+	bench_options options;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--messages") == 0 && i + 1 < argc)
+			options.messages = std::max<uint64_t>(64, std::strtoull(argv[++i], nullptr, 10));
+		else
+			options.filter = argv[i];
+	}
+
+	for (const auto& entry : BENCHMARKS)
+	{
+		if (options.filter.empty() || std::string(entry.name).find(options.filter) != std::string::npos)
+			entry.run(options);
+	}
+
+	return 0;
+}
@@ -0,0 +1,83 @@
+#pragma once
+// Schwartz Liran
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <subscription/subscription.hpp>
+
+// Received packet : read-only view on a pooled receive buffer plus the endpoint it came
+// from. Copies share the buffer, it goes back to its pool when the last copy is dropped.
+// Receive buffers stay at their full size so reusing one never zero-fills it again,
+// the packet keeps the received length.
+namespace afu
+{
+
+	template<typename Endpoint>
+	class received_packet
+	{
+	private:
+
+		std::shared_ptr<const subscription_data> m_data;
+		size_t m_size = 0;
+		Endpoint m_sender;
+
+	public:
+
+		received_packet() = default;
+
+		// the whole buffer is the payload
+		received_packet(std::shared_ptr<const subscription_data> _data, const Endpoint& _sender) :
+			m_data(std::move(_data)),
+			m_size(m_data == nullptr ? 0 : m_data->size()),
+			m_sender(_sender)
+		{}
+
+		// the first _size bytes of the buffer are the payload
+		received_packet(std::shared_ptr<const subscription_data> _data, size_t _size, const Endpoint& _sender) :
+			m_data(std::move(_data)),
+			m_size(_size),
+			m_sender(_sender)
+		{}
+
+		const unsigned char* data() const noexcept
+		{
+			return m_data == nullptr ? nullptr : m_data->data();
+		}
+
+		size_t size() const noexcept
+		{
+			return m_size;
+		}
+
+		bool empty() const noexcept
+		{
+			return size() == 0;
+		}
+
+		std::string_view view() const noexcept
+		{
+			return std::string_view(reinterpret_cast<const char*>(data()), size());
+		}
+
+		// copies the payload, for handlers that keep it past the packet
+		std::string to_string() const
+		{
+			return std::string(view());
+		}
+
+		const Endpoint& sender() const noexcept
+		{
+			return m_sender;
+		}
+
+		// the pooled buffer itself, it may be longer than size()
+		const std::shared_ptr<const subscription_data>& buffer() const noexcept
+		{
+			return m_data;
+		}
+	};
+
+}
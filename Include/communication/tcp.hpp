@@ -6,7 +6,11 @@
 #include <string>
 #include <thread>
 #include <utils/event.hpp>
+#include <utils/thread_utils.hpp>
+#include <subscription/dispatcher.hpp>
+#include <subscription/subscription.hpp>
 #include <boost/asio.hpp>
+#include "received_packet.hpp"
 #include <condition_variable>
 
 
@@ -16,8 +20,15 @@ namespace afu
 
     class tcpServer {
     public:
+        using packet = afu::received_packet<boost::asio::ip::tcp::endpoint>;
+
+        // Copy of every read, built only while a handler is registered
         afu::smart_event<std::string> handler;
 
+        // Every read without a copy : a view on the pooled buffer it was read into and the
+        // peer. The buffer is recycled once the last packet copy is dropped.
+        afu::smart_event<packet> packet_handler;
+
         tcpServer(uint16_t port, std::function<void(std::string)> func)
             : m_io_context(),
             m_acceptor(m_io_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port))
@@ -35,11 +46,23 @@ namespace afu
             }
         }
 
+        // call before start()
+        void set_thread_config(const thread_config& config) {
+            m_thread_config = config;
+        }
+
+        // call before start(). Handlers then run on disp instead of the I/O thread,
+        // a dispatcher_pool runs independent handlers in parallel.
+        void set_handler_dispatcher(std::shared_ptr<afu::dispatcher> disp) {
+            m_handler_dispatcher = std::move(disp);
+        }
+
         void start() {
             m_is_running = true;
 
             m_io_thread = std::thread([this]() {
-                m_io_context.run(); // Start handling I/O operations.
+                apply_thread_config(m_thread_config);
+                run_io_context(m_io_context, m_thread_config.spin_budget); // Start handling I/O operations.
                 });
         }
 
@@ -49,7 +72,8 @@ namespace afu
                 [this](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
                     if (!ec) {
                         std::cout << "New Connection Accepted.\n";
-                        std::make_shared<tcpSession>(std::move(socket), handler)->start();
+                        std::make_shared<tcpSession>(std::move(socket), handler, packet_handler, m_recv_pool,
+                            m_handler_dispatcher)->start();
                     }
                     else {
                         std::cerr << "Accept Error: " << ec.message() << std::endl;
@@ -60,22 +84,44 @@ namespace afu
 
         class tcpSession : public std::enable_shared_from_this<tcpSession> {
         public:
-            tcpSession(boost::asio::ip::tcp::socket socket, afu::smart_event<std::string>& handler)
+            tcpSession(boost::asio::ip::tcp::socket socket, afu::smart_event<std::string>& handler,
+                afu::smart_event<packet>& packet_handler, subscription_data_pool& recv_pool,
+                std::shared_ptr<afu::dispatcher> handler_dispatcher)
                 : m_socket(std::move(socket)),
-                m_handler(handler) {}
+                m_handler(handler),
+                m_packet_handler(packet_handler),
+                m_recv_pool(recv_pool),
+                m_handler_dispatcher(std::move(handler_dispatcher)) {
+                boost::system::error_code ec;
+                m_peer = m_socket.remote_endpoint(ec);
+            }
 
             void start() {
                 do_read();
             }
 
         private:
+            template<typename Arg>
+            void invoke_handler(const afu::smart_event<Arg>& event, const Arg& arg) {
+                if (m_handler_dispatcher != nullptr)
+                    event.invoke_async(*m_handler_dispatcher, arg);
+                else
+                    event.invoke(arg);
+            }
+
             void do_read() {
                 auto self = shared_from_this();
-                m_socket.async_read_some(boost::asio::buffer(m_recv_buffer),
+                m_recv_buffer = m_recv_pool.acquire(RECV_BUFFER_SIZE);
+                m_socket.async_read_some(boost::asio::buffer(m_recv_buffer->get_ref_buffer()),
                     [this, self](boost::system::error_code ec, std::size_t bytes_received) {
                         if (!ec) {
-                            std::string msg(m_recv_buffer.data(), bytes_received);
-                            m_handler.invoke(msg);
+                            packet received(std::move(m_recv_buffer), bytes_received, m_peer);
+                            if (!m_packet_handler.empty())
+                                invoke_handler(m_packet_handler, received);
+
+                            if (!m_handler.empty())
+                                invoke_handler(m_handler, received.to_string());
+
                             do_read(); // Continue reading data.
                         }
                         else {
@@ -84,16 +130,25 @@ namespace afu
                     });
             }
 
+            static constexpr size_t RECV_BUFFER_SIZE = 1024;
+
             boost::asio::ip::tcp::socket m_socket;
             afu::smart_event<std::string>& m_handler;
+            afu::smart_event<packet>& m_packet_handler;
+            subscription_data_pool& m_recv_pool;
+            std::shared_ptr<afu::dispatcher> m_handler_dispatcher;
 
-            std::array<char, 1024> m_recv_buffer;
+            boost::asio::ip::tcp::endpoint m_peer;
+            std::shared_ptr<subscription_data> m_recv_buffer;
         };
 
+        subscription_data_pool m_recv_pool;
         boost::asio::io_context m_io_context;
         boost::asio::ip::tcp::acceptor m_acceptor;
 
         std::thread m_io_thread;
+        thread_config m_thread_config;
+        std::shared_ptr<afu::dispatcher> m_handler_dispatcher;
 
         bool m_is_running = false;
     };
@@ -1,14 +1,30 @@
 #pragma once
 #include <iostream>
 #include <queue>
+#include <algorithm>
 #include <array>
+#include <cstring>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 #include <utils/event.hpp>
+#include <utils/mpmc_queue.hpp>
+#include <utils/thread_utils.hpp>
+#include <subscription/dispatcher.hpp>
+#include <subscription/subscription.hpp>
 #include <boost/asio.hpp>
+#include "received_packet.hpp"
 #include <condition_variable>
 
+#if defined(__linux__)
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#define AFU_UDP_MMSG 1
+#else
+#define AFU_UDP_MMSG 0
+#endif
 
 
 namespace afu
@@ -18,12 +34,45 @@ namespace afu
 	{
 	public:
 
+		using packet = afu::received_packet<boost::asio::ip::udp::endpoint>;
+
+		// Copy of every datagram, built only while a handler is registered
 		afu::smart_event<std::string> handler;
 
+		// Every datagram without a copy : a view on the pooled buffer it was received into
+		// and the sender. The buffer is recycled once the last packet copy is dropped.
+		afu::smart_event<packet> packet_handler;
+
+		// Every datagram taken by the dispatching thread in one go, after handler ran for each.
+		// The packets view their pooled buffers like packet_handler, nothing is copied.
+		afu::smart_event<std::vector<packet>> batch_handler;
+
+		// I/O counters, average_*_batch() is datagrams per system call
+		struct io_statistics
+		{
+			uint64_t recv_calls;
+			uint64_t recv_datagrams;
+			uint64_t recv_dropped;
+			uint64_t send_calls;
+			uint64_t send_datagrams;
+
+			double average_recv_batch() const
+			{
+				return recv_calls == 0 ? 0.0 : static_cast<double>(recv_datagrams) / recv_calls;
+			}
+
+			double average_send_batch() const
+			{
+				return send_calls == 0 ? 0.0 : static_cast<double>(send_datagrams) / send_calls;
+			}
+		};
+
 		udpCommunication(uint32_t _local_port, std::function<void(std::string)> _func) :
 			m_io_context(),
 			m_socket(m_io_context, boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), _local_port)),
-			m_local_port(_local_port)
+			m_local_port(_local_port),
+			m_recving_queue(RECV_QUEUE_CAPACITY),
+			m_recv_pool(0, RECV_QUEUE_CAPACITY)
 		{
 			handler += _func;
 
@@ -35,7 +84,9 @@ namespace afu
 			m_socket(m_io_context, boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), _local_port)),
 			m_remote_ip(_remote_ip),
 			m_remote_port(_remote_port),
-			m_local_port(_local_port)
+			m_local_port(_local_port),
+			m_recving_queue(RECV_QUEUE_CAPACITY),
+			m_recv_pool(0, RECV_QUEUE_CAPACITY)
 		{
 			handler += _func;
 			std::cout << "Connected.\n";
@@ -45,42 +96,110 @@ namespace afu
 		{
 			m_is_running = false;
 			m_io_context.stop();
-			m_io_context_thread->join();
-			m_dispatching_thread->join();
+			m_recving_queue.close();
+			if (m_io_context_thread != nullptr)
+				m_io_context_thread->join();
+
+			if (m_dispatching_thread != nullptr)
+				m_dispatching_thread->join();
+
 			m_socket.close();
 		}
 
+		// call before start(). The I/O and dispatching threads get "-io" / "-dispatch" name suffixes.
+		void set_thread_config(const thread_config& _config)
+		{
+			m_thread_config = _config;
+		}
+
+		// call before start(). Handlers then run on _disp instead of the dispatching thread,
+		// a dispatcher_pool runs independent handlers in parallel.
+		void set_handler_dispatcher(std::shared_ptr<afu::dispatcher> _disp)
+		{
+			m_handler_dispatcher = std::move(_disp);
+		}
+
+		// call before start(). On Linux the socket is then read with recvmmsg and async_send()
+		// is flushed with sendmmsg, up to _batch_size datagrams per call. Returns false where
+		// that is not available, the single message I/O is used instead.
+		bool set_batch_io(size_t _batch_size)
+		{
+			m_io_batch_size = std::min(_batch_size, MAX_IO_BATCH_SIZE);
+			return AFU_UDP_MMSG && m_io_batch_size > 1;
+		}
+
+		// datagrams discarded because the dispatching thread fell RECV_QUEUE_CAPACITY behind
+		uint64_t recv_dropped() const
+		{
+			return m_recv_dropped.load(std::memory_order_relaxed);
+		}
+
+		io_statistics get_io_statistics() const
+		{
+			return {
+				m_recv_calls.load(std::memory_order_relaxed),
+				m_recv_datagrams.load(std::memory_order_relaxed),
+				m_recv_dropped.load(std::memory_order_relaxed),
+				m_send_calls.load(std::memory_order_relaxed),
+				m_send_datagrams.load(std::memory_order_relaxed) };
+		}
+
 		void start()
 		{
+			m_is_running = true;
+#if AFU_UDP_MMSG
+			if (batch_io())
+			{
+				m_recv_batch.prepare(m_io_batch_size);
+				m_recv_slots.resize(m_io_batch_size);
+				m_recv_senders.resize(m_io_batch_size);
+				m_send_batch.prepare(m_io_batch_size);
+			}
+#endif
 			m_io_context_thread = std::make_shared<std::thread>([&]()
 				{
-					m_is_running = true;
+					apply_thread_config(named_config("-io"));
 					while (m_is_running)
 					{
 						start_receive();
-						m_io_context.run();
+						run_io_context(m_io_context, m_thread_config.spin_budget);
 					}
 				}
 			);
 
+			m_recving_queue.set_spin_budget(m_thread_config.spin_budget);
 			m_dispatching_thread = std::make_shared<std::thread>([&]()
 				{
-					m_is_running = true;
-					while (m_is_running)
+					apply_thread_config(named_config("-dispatch"));
+
+					// one wait per burst, then everything queued behind it in one go
+					std::vector<packet> batch(std::max(DISPATCH_BATCH_SIZE, m_io_batch_size));
+					std::vector<packet> batch_args;
+					batch_args.reserve(batch.size());
+					while (m_recving_queue.pop(batch[0]))
 					{
-						std::unique_lock<std::mutex> lock(m_cv_mutex);
-						m_cv.wait(lock,[&]()
-							{
-								return (!m_recving_queue.empty());
-							});
-						while (!m_recving_queue.empty())
+						auto count = 1 + m_recving_queue.pop_bulk(batch.data() + 1, batch.size() - 1);
+						for (size_t i = 0; i < count; ++i)
+						{
+							if (!packet_handler.empty())
+								invoke_handler(packet_handler, batch[i]);
+
+							if (!handler.empty())
+								invoke_handler(handler, batch[i].to_string());
+						}
+
+						if (!batch_handler.empty())
 						{
-							std::string val = m_recving_queue.front();
-							handler.invoke(val);
-							m_recving_queue.pop();
+							for (size_t i = 0; i < count; ++i)
+								batch_args.push_back(std::move(batch[i]));
 
+							invoke_handler(batch_handler, batch_args);
+							batch_args.clear();
 						}
 
+						// hand the buffers back to the pool now rather than on the next burst
+						for (size_t i = 0; i < count; ++i)
+							batch[i] = packet();
 					}
 				}
 			);
@@ -101,6 +220,7 @@ namespace afu
 					m_remote_port);
 
 				m_socket.send_to(boost::asio::buffer(msg), client);
+				count_send(1);
 			}
 			catch (std::exception& e) {
 				std::cerr << "Client exception: " << e.what() << std::endl;
@@ -152,25 +272,83 @@ namespace afu
 
 	private:
 
+		thread_config named_config(const char* _suffix) const
+		{
+			auto config = m_thread_config;
+			if (!config.name.empty())
+				config.name += _suffix;
+
+			return config;
+		}
+
+		bool batch_io() const
+		{
+			return AFU_UDP_MMSG && m_io_batch_size > 1;
+		}
+
+		void count_recv(size_t _datagrams)
+		{
+			m_recv_calls.fetch_add(1, std::memory_order_relaxed);
+			m_recv_datagrams.fetch_add(_datagrams, std::memory_order_relaxed);
+		}
+
+		void count_send(size_t _datagrams)
+		{
+			m_send_calls.fetch_add(1, std::memory_order_relaxed);
+			m_send_datagrams.fetch_add(_datagrams, std::memory_order_relaxed);
+		}
+
+		template<typename Arg>
+		void invoke_handler(const afu::smart_event<Arg>& _event, const Arg& _arg)
+		{
+			if (m_handler_dispatcher != nullptr)
+				_event.invoke_async(*m_handler_dispatcher, _arg);
+			else
+				_event.invoke(_arg);
+		}
+
+		std::shared_ptr<subscription_data> acquire_recv_buffer()
+		{
+			return m_recv_pool.acquire(RECV_BUFFER_SIZE);
+		}
+
+		void push_received(std::shared_ptr<subscription_data> _data, size_t _size, const boost::asio::ip::udp::endpoint& _sender)
+		{
+			// a full queue drops the datagram rather than stall the socket, the buffer goes back to the pool
+			if (!m_recving_queue.try_emplace(std::move(_data), _size, _sender))
+				++m_recv_dropped;
+		}
+
+		// runs on the I/O thread
 		void countiue_send()
 		{
+#if AFU_UDP_MMSG
+			if (batch_io())
+			{
+				flush_send_batch();
+				return;
+			}
+#endif
 			std::lock_guard<std::mutex> lock(m_sender_queue_mutex); // Lock for thread safety
 
 			if (!m_sender_queue.empty())
 			{
-				// Get the message from the front of the queue
-				const std::string message = m_sender_queue.front();
+				// Get the message from the front of the queue, it has to live until the send completed
+				auto message = std::make_shared<std::string>(std::move(m_sender_queue.front()));
 				m_sender_queue.pop();
 
 				boost::asio::ip::udp::endpoint m_endpoint(boost::asio::ip::address::from_string(m_remote_ip), m_remote_port);
 
 				// Send the message asynchronously
-				m_socket.async_send_to(boost::asio::buffer(message), m_endpoint,
-					[this](const boost::system::error_code& error, std::size_t /*bytes_transferred*/)
+				m_socket.async_send_to(boost::asio::buffer(*message), m_endpoint,
+					[this, message](const boost::system::error_code& error, std::size_t /*bytes_transferred*/)
 					{
 						if (!error)
+						{
+							count_send(1);
 							// Continue sending if there are more messages in the queue
 							countiue_send();
+						}
 						else
 							std::cerr << "Send Error: " << error.message() << std::endl;
 
@@ -180,17 +358,21 @@ namespace afu
 
 		void start_receive() 
 		{
-			m_socket.async_receive_from(boost::asio::buffer(m_recv_buffer), m_recv_endpoint,
+#if AFU_UDP_MMSG
+			if (batch_io())
+			{
+				start_batch_receive();
+				return;
+			}
+#endif
+			m_recv_buffer = acquire_recv_buffer();
+			m_socket.async_receive_from(boost::asio::buffer(m_recv_buffer->get_ref_buffer()), m_recv_endpoint,
 				[&](const boost::system::error_code& error, std::size_t bytes_received)
 				{
 					if (!error) 
 					{
-						std::string recv_msg(m_recv_buffer.data(), bytes_received);
-						{
-							std::lock_guard < std::mutex > lk(m_cv_mutex);
-							m_recving_queue.push(recv_msg);
-						}
-						m_cv.notify_all();
+						count_recv(1);
+						push_received(std::move(m_recv_buffer), bytes_received, m_recv_endpoint);
 						start_receive();
 					}
 					else
@@ -200,6 +382,146 @@ namespace afu
 				});
 		}
 
+#if AFU_UDP_MMSG
+		// mmsghdr array for recvmmsg / sendmmsg, every header has one iovec. They are
+		// pointed at the pooled receive buffers or the queued strings before every call.
+		struct mmsg_batch
+		{
+			std::vector<iovec> m_iovecs;
+			std::vector<mmsghdr> m_headers;
+
+			void prepare(size_t _size)
+			{
+				m_iovecs.assign(_size, iovec{});
+				m_headers.assign(_size, mmsghdr{});
+				for (size_t i = 0; i < _size; ++i)
+				{
+					m_headers[i].msg_hdr.msg_iov = &m_iovecs[i];
+					m_headers[i].msg_hdr.msg_iovlen = 1;
+				}
+			}
+
+			size_t size() const noexcept
+			{
+				return m_headers.size();
+			}
+		};
+
+		// Waits for the socket to be readable, then takes up to m_io_batch_size datagrams
+		// with one recvmmsg, straight into pooled buffers
+		void start_batch_receive()
+		{
+			for (size_t i = 0; i < m_recv_batch.size(); ++i)
+			{
+				// slots handed on by the last call get a new buffer
+				if (m_recv_slots[i] == nullptr)
+				{
+					m_recv_slots[i] = acquire_recv_buffer();
+					m_recv_batch.m_iovecs[i].iov_base = m_recv_slots[i]->get_ref_buffer().data();
+					m_recv_batch.m_iovecs[i].iov_len = RECV_BUFFER_SIZE;
+				}
+
+				m_recv_batch.m_headers[i].msg_hdr.msg_name = m_recv_senders[i].data();
+				m_recv_batch.m_headers[i].msg_hdr.msg_namelen = static_cast<socklen_t>(m_recv_senders[i].capacity());
+			}
+
+			m_socket.async_wait(boost::asio::ip::udp::socket::wait_read,
+				[this](const boost::system::error_code& error)
+				{
+					if (error)
+					{
+						std::cerr << "Error on receive: " << error.message() << std::endl;
+						return;
+					}
+
+					auto received = ::recvmmsg(m_socket.native_handle(), m_recv_batch.m_headers.data(),
+						static_cast<unsigned int>(m_recv_batch.size()), MSG_DONTWAIT, nullptr);
+					if (received > 0)
+					{
+						count_recv(static_cast<size_t>(received));
+						for (int i = 0; i < received; ++i)
+						{
+							auto& header = m_recv_batch.m_headers[i];
+							m_recv_senders[i].resize(header.msg_hdr.msg_namelen);
+							push_received(std::move(m_recv_slots[i]), header.msg_len, m_recv_senders[i]);
+						}
+					}
+					else if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+					{
+						std::cerr << "Error on receive: " << std::strerror(errno) << std::endl;
+					}
+
+					start_batch_receive();
+				});
+		}
+
+		// Sends the queued messages in order, up to m_io_batch_size per sendmmsg. When the
+		// socket buffer is full the rest waits for the socket to become writable.
+		void flush_send_batch()
+		{
+			if (m_send_waiting)
+				return;
+
+			while (true)
+			{
+				if (m_send_offset == m_send_pending.size())
+				{
+					m_send_pending.clear();
+					m_send_offset = 0;
+
+					std::lock_guard<std::mutex> lock(m_sender_queue_mutex);
+					while (!m_sender_queue.empty() && m_send_pending.size() < m_send_batch.size())
+					{
+						m_send_pending.push_back(std::move(m_sender_queue.front()));
+						m_sender_queue.pop();
+					}
+				}
+
+				if (m_send_pending.empty())
+					return;
+
+				boost::asio::ip::udp::endpoint endpoint(boost::asio::ip::address::from_string(m_remote_ip), m_remote_port);
+				auto count = m_send_pending.size() - m_send_offset;
+				for (size_t i = 0; i < count; ++i)
+				{
+					auto& message = m_send_pending[m_send_offset + i];
+					m_send_batch.m_iovecs[i].iov_base = const_cast<char*>(message.data());
+					m_send_batch.m_iovecs[i].iov_len = message.size();
+					m_send_batch.m_headers[i].msg_hdr.msg_name = endpoint.data();
+					m_send_batch.m_headers[i].msg_hdr.msg_namelen = static_cast<socklen_t>(endpoint.size());
+				}
+
+				auto sent = ::sendmmsg(m_socket.native_handle(), m_send_batch.m_headers.data(),
+					static_cast<unsigned int>(count), MSG_DONTWAIT);
+				if (sent < 0)
+				{
+					if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+					{
+						m_send_waiting = true;
+						m_socket.async_wait(boost::asio::ip::udp::socket::wait_write,
+							[this](const boost::system::error_code& error)
+							{
+								m_send_waiting = false;
+								if (!error)
+									flush_send_batch();
+								else
+									std::cerr << "Send Error: " << error.message() << std::endl;
+							});
+						return;
+					}
+
+					// the first message was refused, skip it like a failed async_send_to
+					std::cerr << "Send Error: " << std::strerror(errno) << std::endl;
+					++m_send_offset;
+					continue;
+				}
+
+				count_send(static_cast<size_t>(sent));
+				m_send_offset += static_cast<size_t>(sent);
+			}
+		}
+#endif
+
 
 		// Getter setter Attributes
 
@@ -231,17 +553,42 @@ namespace afu
 
 
 		//async recv
-		std::mutex m_cv_mutex;
-		std::condition_variable m_cv;
-		std::array<char, 1024> m_recv_buffer;
-		std::queue<std::string> m_recving_queue;
+		static constexpr size_t RECV_QUEUE_CAPACITY = 4096;
+		static constexpr size_t DISPATCH_BATCH_SIZE = 32;
+		static constexpr size_t RECV_BUFFER_SIZE = 1024;
+		static constexpr size_t MAX_IO_BATCH_SIZE = 1024;  // UIO_MAXIOV
+
+		std::shared_ptr<subscription_data> m_recv_buffer;
+		afu::mpmc_queue<packet> m_recving_queue;
+		subscription_data_pool m_recv_pool;
+		std::atomic<uint64_t> m_recv_dropped{ 0 };
 		boost::asio::ip::udp::endpoint m_recv_endpoint;
+
+		// batched I/O, the batches and the pending sends belong to the I/O thread
+		size_t m_io_batch_size = 1;
+#if AFU_UDP_MMSG
+		mmsg_batch m_recv_batch;
+		std::vector<std::shared_ptr<subscription_data>> m_recv_slots;
+		std::vector<boost::asio::ip::udp::endpoint> m_recv_senders;
+		mmsg_batch m_send_batch;
+		std::vector<std::string> m_send_pending;
+		size_t m_send_offset = 0;
+		bool m_send_waiting = false;
+#endif
+
+		std::atomic<uint64_t> m_recv_calls{ 0 };
+		std::atomic<uint64_t> m_recv_datagrams{ 0 };
+		std::atomic<uint64_t> m_send_calls{ 0 };
+		std::atomic<uint64_t> m_send_datagrams{ 0 };
 		
 
 
 		bool m_print = true;
 
+		thread_config m_thread_config;
+		std::shared_ptr<afu::dispatcher> m_handler_dispatcher;
+
 
-		bool m_is_running = false;
+		std::atomic_bool m_is_running{ false };
 	};
 }
\ No newline at end of file
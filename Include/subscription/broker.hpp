@@ -0,0 +1,126 @@
+#pragma once
+// Schwartz Liran
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <utils/snapshot.hpp>
+#include "subscription.hpp"
+
+
+namespace afu
+{
+
+	// Broker : owns subscribers by topic name so they can be wired from configuration.
+	// The topic table is copy-on-write, lookups and publish hash the name against an
+	// immutable snapshot and never take a lock; only creating/removing topics does.
+	class broker
+	{
+	private:
+
+		using topic_map = std::unordered_map<std::string, std::shared_ptr<subscriber>>;
+
+		afu::snapshot_ptr<topic_map> m_topics;
+
+	public:
+
+		broker() = default;
+
+		broker(const broker& other) = delete;
+
+		// Returns the existing topic when it was already created with the same size
+		std::shared_ptr<subscriber> create_topic(const std::string& _name, size_t _data_size)
+		{
+			if (_name.empty())
+				throw std::invalid_argument("topic name is empty");
+
+			if (auto topic = get_topic(_name))
+			{
+				if (topic->data_size() != _data_size)
+					throw std::invalid_argument("topic " + _name + " already exists with another data size");
+
+				return topic;
+			}
+
+			return m_topics.update([&](topic_map& _topics)
+				{
+					auto it = _topics.find(_name);
+					if (it == _topics.end())
+						it = _topics.emplace(_name, std::make_shared<subscriber>(_data_size)).first;
+
+					return it->second;
+				});
+		}
+
+		// nullptr when the topic does not exist
+		std::shared_ptr<subscriber> get_topic(const std::string& _name) const
+		{
+			auto topics = m_topics.load();
+			auto it = topics->find(_name);
+			return it == topics->end() ? nullptr : it->second;
+		}
+
+		bool has_topic(const std::string& _name) const
+		{
+			return get_topic(_name) != nullptr;
+		}
+
+		// Subscribers already holding the topic keep it alive
+		bool remove_topic(const std::string& _name)
+		{
+			return m_topics.update([&](topic_map& _topics)
+				{
+					return _topics.erase(_name) > 0;
+				});
+		}
+
+		std::vector<std::string> topic_names() const
+		{
+			auto topics = m_topics.load();
+			std::vector<std::string> names;
+			names.reserve(topics->size());
+			for (const auto& topic : *topics)
+				names.push_back(topic.first);
+
+			return names;
+		}
+
+		subscription_id subscribe(const std::string& _name, afu::dispatcher* _disp, subscription_callback _func,
+			delivery_policy _policy = delivery_policy::each)
+		{
+			return get_existing_topic(_name)->subscribe(_disp, _func, _policy);
+		}
+
+		subscription_id subscribe_batch(const std::string& _name, afu::dispatcher* _disp, subscription_batch_callback _func)
+		{
+			return get_existing_topic(_name)->subscribe_batch(_disp, _func);
+		}
+
+		bool unsubscribe(const std::string& _name, subscription_id _id)
+		{
+			auto topic = get_topic(_name);
+			return topic != nullptr && topic->unsubscribe(_id);
+		}
+
+		// For hot paths keep the shared_ptr from create_topic/get_topic and write to it directly
+		template<typename T>
+		void publish(const std::string& _name, const T& _val)
+		{
+			get_existing_topic(_name)->write(_val);
+		}
+
+	private:
+
+		std::shared_ptr<subscriber> get_existing_topic(const std::string& _name) const
+		{
+			auto topic = get_topic(_name);
+			if (topic == nullptr)
+				throw std::invalid_argument("unknown topic " + _name);
+
+			return topic;
+		}
+	};
+
+}
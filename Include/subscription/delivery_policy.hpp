@@ -0,0 +1,20 @@
+#pragma once
+// Schwartz Liran
+
+#include <cstdint>
+
+namespace afu
+{
+
+	// Handle returned by subscribe(), used to unsubscribe again. 0 is never a valid id.
+	using subscription_id = std::uint64_t;
+
+	// How a subscriber hands its samples to a subscribed dispatcher
+	enum class delivery_policy
+	{
+		each,     // one action and one wake-up per sample
+		batched,  // all samples pending at notify time go out in a single action
+		latest    // conflated: at most one pending update, the dispatcher only sees the newest sample
+	};
+
+}
@@ -3,13 +3,23 @@
 
 
 #include <iostream>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
-#include <queue>
 #include <thread>
 #include <chrono>
+#include <stdexcept>
 #include <interface/worker_interface.h>
+#include <utils/mpsc_queue.hpp>
+#include <utils/task.hpp>
+#include <utils/async_result.hpp>
+#include <utils/thread_utils.hpp>
+#include <utils/instrumentation.hpp>
+#include <utils/timer_wheel.hpp>
 
 
 
@@ -29,6 +39,12 @@ namespace afu
 			run_action();
 		}
 
+		// A queued run was dropped or refused by the overflow policy, or its dispatcher was
+		// destroyed first. Actions that are queued at most once reset that state here.
+		// Must not throw.
+		virtual void on_dropped()
+		{}
+
 	protected:
 
 		virtual void run_action() = 0;
@@ -36,58 +52,267 @@ namespace afu
 	};
 
 
+	// What a bounded dispatcher does when its queue is at capacity
+	enum class overflow_policy
+	{
+		block,        // producer waits for room
+		drop_newest,  // the new action is discarded
+		drop_oldest,  // the oldest queued action is discarded to make room
+		reject        // the new action is refused, begin_invoke / add_action return false
+	};
+
+	struct dispatcher_stats
+	{
+		uint64_t enqueued;
+		uint64_t executed;
+		uint64_t dropped;    // drop_newest / drop_oldest
+		uint64_t rejected;   // reject, or block called from the dispatcher thread itself
+		size_t depth;        // actions currently queued
+		size_t peak_depth;
+	};
+
+	// Histograms stay empty unless built with AFU_ENABLE_INSTRUMENTATION
+	struct dispatcher_metrics_snapshot
+	{
+		std::uint64_t timestamp_ns;
+		dispatcher_stats stats;
+		histogram_snapshot queue_wait;  // enqueue to start of execution
+		histogram_snapshot execution;
+	};
+
+
+	// Dispatcher : one worker thread executing queued actions in order.
+	// Producers push into a lock-free MPSC queue and never wait for a running action.
+	// An idle worker parks on a condition variable and is only signalled when it
+	// actually sleeps, so both an idle dispatcher and a busy producer cost nothing extra.
+	// Delayed and periodic actions live in a timer wheel owned by the worker thread,
+	// which parks until the next deadline instead of polling.
+	// The queue holds afu::task objects: post() stores a lambda in place, without a
+	// shared_ptr, while async_action_context actions are wrapped in a task.
+	// With a thread_config spin budget the worker busy-polls before parking, which takes
+	// the condition variable wake-up out of the latency of a busy topic.
 	class dispatcher : public worker_interface
 	{
 	public:
 
+		static constexpr size_t UNBOUNDED = 0;
+
+		using timer_clock = std::chrono::steady_clock;
+
+		// Action plus ordering key, see begin_invoke(_action, _order_key)
+		using ordered_action = std::pair<size_t, std::shared_ptr<async_action_context>>;
 
 		dispatcher() = default;
 
+		// Spreads owner addresses (and an optional id) over the key space
+		static size_t make_order_key(const void* _owner, uint64_t _salt = 0) noexcept
+		{
+			uint64_t key = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(_owner)) ^ (_salt * 0x9E3779B97F4A7C15ull);
+			key ^= key >> 33;
+			key *= 0xFF51AFD7ED558CCDull;
+			key ^= key >> 33;
+			return static_cast<size_t>(key);
+		}
+
+		// _capacity == UNBOUNDED keeps the queue unbounded
+		dispatcher(size_t _capacity, overflow_policy _policy = overflow_policy::block) :
+			m_capacity(_capacity),
+			m_overflow_policy(_policy)
+		{}
 
-		virtual void add_action(const std::shared_ptr<async_action_context>& _action)
+
+		// false when the action was dropped or rejected by the overflow policy
+		virtual bool add_action(const std::shared_ptr<async_action_context>& _action)
 		{
-			std::lock_guard<std::mutex> lock(m_lock_invoke_thread);
-			m_action_q.push(_action);
+			return enqueue(make_task(_action));
 		}
 
-		virtual void add_list_action(const std::vector<std::shared_ptr<async_action_context>>& _action)
+		// Returns how many actions were queued, the rest was dropped or rejected
+		virtual size_t add_list_action(const std::vector<std::shared_ptr<async_action_context>>& _action)
 		{
-			std::lock_guard<std::mutex> lock(m_lock_invoke_thread);
+			size_t accepted = 0;
 			for(const auto& ac : _action)
-				m_action_q.push(ac);
-			
+				accepted += push_action(make_task(ac)) ? 1 : 0;
+
+			unpark();
+			return accepted;
 		}
 
-		
-		~dispatcher()
+		// One thread runs everything in order already, the keys only matter to dispatcher_pool
+		virtual size_t add_list_action(const std::vector<ordered_action>& _action)
 		{
-			m_still_running = false;
-			if (m_invoke_thread.joinable())
-			{
-				m_invoke_thread.join();
-			}
+			size_t accepted = 0;
+			for (const auto& ac : _action)
+				accepted += push_action(make_task(ac.second)) ? 1 : 0;
+
+			unpark();
+			return accepted;
 		}
 
-		void begin_invoke()
+		// Runs _func() on the dispatcher thread. Captures up to task::INLINE_SIZE bytes are
+		// stored in the queue node, nothing else is allocated once the node pool is warm.
+		// false when the overflow policy dropped or rejected it.
+		template<typename F>
+		bool post(F&& _func)
 		{
-			if (m_invoke_thread.joinable() && 
-				m_still_running == true &&
-				m_action_q.empty() == false)
-			{
-				m_invoke_thread_cv.notify_all();
-			}
+			return enqueue(task(std::forward<F>(_func)));
+		}
+
+		// Same order key, same ordering guarantee as begin_invoke(_action, _order_key)
+		template<typename F>
+		bool post(F&& _func, size_t _order_key)
+		{
+			return enqueue(task(std::forward<F>(_func)), _order_key);
 		}
 
-		void begin_invoke(const std::shared_ptr<async_action_context>& _action)
+		// Runs _func() on the dispatcher thread and hands its return value (or exception)
+		// back through the result. A dropped or rejected action completes it with an exception.
+		template<typename F, typename R = std::invoke_result_t<std::decay_t<F>&>>
+		async_result<R> invoke_async(F&& _func)
 		{
-			add_action(_action);
-			if (m_invoke_thread.joinable() && 
-				m_still_running == true && 
-				m_action_q.empty() == false)
+			async_promise<R> promise;
+			auto result = promise.get_result();
+			post([func = std::forward<F>(_func), promise = std::move(promise)]() mutable
+				{
+					promise.run(func);
+				});
+			return result;
+		}
+
+#if AFU_HAS_COROUTINES
+		// co_await disp.schedule() resumes the coroutine on this dispatcher's thread.
+		// If the dispatcher refuses the post the coroutine simply carries on where it is;
+		// with overflow_policy::drop_oldest a queued resumption may be dropped, avoid it there.
+		class schedule_awaitable
+		{
+			dispatcher* m_dispatcher;
+
+		public:
+
+			explicit schedule_awaitable(dispatcher* _dispatcher) :
+				m_dispatcher(_dispatcher)
+			{}
+
+			bool await_ready() const noexcept
 			{
-				m_invoke_thread_cv.notify_all();
+				return false;
+			}
+
+			bool await_suspend(std::coroutine_handle<> _handle)
+			{
+				return m_dispatcher->post([_handle]()
+					{
+						_handle.resume();
+					});
 			}
+
+			void await_resume() const noexcept
+			{}
+		};
+
+		schedule_awaitable schedule()
+		{
+			return schedule_awaitable(this);
 		}
+#endif
+
+		
+		virtual ~dispatcher()
+		{
+			stop();
+		}
+
+		virtual void begin_invoke()
+		{
+			unpark();
+		}
+
+		bool begin_invoke(const std::shared_ptr<async_action_context>& _action)
+		{
+			return add_action(_action);
+		}
+
+		// Actions posted with the same _order_key run one at a time and in posting order,
+		// even on a dispatcher_pool. A single dispatcher keeps that order anyway.
+		virtual bool begin_invoke(const std::shared_ptr<async_action_context>& _action, size_t _order_key)
+		{
+			return enqueue(make_task(_action), _order_key);
+		}
+
+		// Timers are not subject to the overflow policy, they enter the queue when they fire.
+		// Cancel through the returned handle, from any thread.
+		template<typename Rep, typename Period>
+		timer_handle post_after(std::chrono::duration<Rep, Period> _delay, const std::shared_ptr<async_action_context>& _action)
+		{
+			return add_timer(timer_clock::now() + std::chrono::duration_cast<timer_clock::duration>(_delay), timer_clock::duration::zero(), _action);
+		}
+
+		timer_handle post_at(timer_clock::time_point _time, const std::shared_ptr<async_action_context>& _action)
+		{
+			return add_timer(_time, timer_clock::duration::zero(), _action);
+		}
+
+		// First run one period from now. Missed periods are skipped, the schedule does not drift.
+		template<typename Rep, typename Period>
+		timer_handle post_every(std::chrono::duration<Rep, Period> _period, const std::shared_ptr<async_action_context>& _action)
+		{
+			auto period = std::chrono::duration_cast<timer_clock::duration>(_period);
+			if (period <= timer_clock::duration::zero())
+				throw std::invalid_argument("timer period must be positive");
+
+			return add_timer(timer_clock::now() + period, period, _action);
+		}
+
+		// call before start()
+		void set_capacity(size_t _capacity, overflow_policy _policy)
+		{
+			m_capacity = _capacity;
+			m_overflow_policy = _policy;
+		}
+
+		size_t get_capacity() const noexcept
+		{
+			return m_capacity;
+		}
+
+		overflow_policy get_overflow_policy() const noexcept
+		{
+			return m_overflow_policy;
+		}
+
+		// call before start()
+		void set_thread_config(const thread_config& _config)
+		{
+			m_thread_config = _config;
+		}
+
+		const thread_config& get_thread_config() const noexcept
+		{
+			return m_thread_config;
+		}
+
+		dispatcher_metrics_snapshot get_metrics()
+		{
+			dispatcher_metrics_snapshot snap;
+			snap.timestamp_ns = instrument_now_ns();
+			snap.stats = get_stats();
+			AFU_INSTRUMENT(snap.queue_wait = m_metrics.m_queue_wait.snapshot();)
+			AFU_INSTRUMENT(snap.execution = m_metrics.m_execution.snapshot();)
+			return snap;
+		}
+
+		virtual dispatcher_stats get_stats()
+		{
+			dispatcher_stats stats;
+			stats.enqueued = m_enqueued.load(std::memory_order_relaxed);
+			stats.executed = m_executed.load(std::memory_order_relaxed);
+			stats.dropped = m_dropped.load(std::memory_order_relaxed);
+			stats.rejected = m_rejected.load(std::memory_order_relaxed);
+			stats.depth = m_depth.load(std::memory_order_relaxed);
+			stats.peak_depth = m_peak_depth.load(std::memory_order_relaxed);
+			return stats;
+		}
+
 		virtual void init() override
 		{
 			// TBD
@@ -96,7 +321,14 @@ namespace afu
 		virtual void stop() override
 		{
 			m_still_running = false;
-			if (m_invoke_thread.joinable())
+			{
+				std::lock_guard<std::mutex> lock(m_park_mutex);
+				m_parked.store(false);
+			}
+			m_park_cv.notify_all();
+			m_not_full_cv.notify_all();
+
+			if (m_invoke_thread.joinable() && m_invoke_thread.get_id() != std::this_thread::get_id())
 			{
 				m_invoke_thread.join();
 			}
@@ -107,25 +339,17 @@ namespace afu
 		{
 			try
 			{
+				m_still_running = true;
 				m_invoke_thread = std::thread([&]()
 					{
-						m_id = std::this_thread::get_id();
-						m_still_running = true;
+						m_id.store(std::this_thread::get_id());
+						apply_thread_config(m_thread_config);
 						while (m_still_running)
 						{
-							std::unique_lock<std::mutex> lock(m_lock_invoke_thread);
-							m_invoke_thread_cv.wait_for(lock, std::chrono::seconds(5), [&]()
-								{
-									return (m_action_q.empty() == false);
-								}
-							);
-
-							while (!m_action_q.empty())
-							{
-								auto& action = m_action_q.front();
-								invoke(action);
-								m_action_q.pop();
-							}
+							drain();
+							run_timers();
+							if (!spin())
+								park();
 						}
 					});
 			}
@@ -144,21 +368,304 @@ namespace afu
 		std::thread::id get_id()
 		{
 			if (m_invoke_thread.joinable())
-				return m_id;
+				return m_id.load();
 
 			return std::thread::id();
 		}
 
-	private:
+	protected:
 
+		// Queue element, remembers when it was queued for the queue wait histogram
+		struct queued_task
+		{
+			task m_task;
+			AFU_INSTRUMENT(std::uint64_t m_enqueued_ns = 0;)
 
-		bool invoke(const std::shared_ptr<afu::async_action_context>& _action)
+			queued_task() = default;
+
+			explicit queued_task(task&& _task) :
+				m_task(std::move(_task))
+			{
+				AFU_INSTRUMENT(m_enqueued_ns = instrument_now_ns();)
+			}
+		};
+
+		AFU_INSTRUMENT(dispatcher_metrics m_metrics;)
+
+		// Every action enters the queue through here, dispatcher_pool overrides both
+		virtual bool enqueue(task&& _task)
+		{
+			if (!push_action(std::move(_task)))
+				return false;
+
+			unpark();
+			return true;
+		}
+
+		// a single thread already runs everything in order
+		virtual bool enqueue(task&& _task, size_t /*_order_key*/)
+		{
+			return enqueue(std::move(_task));
+		}
+
+		// Runs the action once. A runner destroyed without running (refused, evicted or
+		// left in the queue) calls on_dropped() instead.
+		struct action_runner
+		{
+			std::shared_ptr<async_action_context> m_action;
+
+			explicit action_runner(const std::shared_ptr<async_action_context>& _action) :
+				m_action(_action)
+			{}
+
+			action_runner(action_runner&& other) noexcept = default;
+
+			~action_runner()
+			{
+				if (m_action != nullptr)
+					m_action->on_dropped();
+			}
+
+			void operator()()
+			{
+				auto action = std::move(m_action);
+				action->begin_invoke();
+			}
+		};
+
+		static task make_task(const std::shared_ptr<async_action_context>& _action)
+		{
+			return task(action_runner(_action));
+		}
+
+		// Runs a due timer. A pool hands it to its workers instead.
+		virtual void fire_timer(const std::shared_ptr<async_action_context>& _action)
 		{
 			try
 			{
 				_action->begin_invoke();
 			}
 			catch (const std::exception&)
+			{
+			}
+			m_executed.fetch_add(1, std::memory_order_relaxed);
+		}
+
+	private:
+
+		struct timer_request
+		{
+			timer_clock::time_point m_deadline;
+			timer_clock::duration m_period;
+			std::shared_ptr<async_action_context> m_action;
+			std::shared_ptr<std::atomic_bool> m_cancelled;
+		};
+
+		timer_handle add_timer(timer_clock::time_point _deadline, timer_clock::duration _period, const std::shared_ptr<async_action_context>& _action)
+		{
+			auto cancelled = std::make_shared<std::atomic_bool>(false);
+			m_timer_q.push(timer_request{ _deadline, _period, _action, cancelled });
+			unpark();
+			return timer_handle(cancelled);
+		}
+
+		// worker thread only
+		void run_timers()
+		{
+			timer_request request;
+			while (m_timer_q.try_pop(request))
+			{
+				m_timers.add(request.m_deadline, request.m_period, std::move(request.m_action), std::move(request.m_cancelled));
+				request = timer_request();
+			}
+
+			if (m_timers.empty())
+				return;
+
+			m_timers.advance(timer_clock::now(), [&](const std::shared_ptr<async_action_context>& _action)
+				{
+					fire_timer(_action);
+				});
+		}
+
+		bool push_action(task&& _action)
+		{
+			auto depth = m_depth.fetch_add(1, std::memory_order_acq_rel);
+			while (m_capacity != UNBOUNDED && depth >= m_capacity)
+			{
+				switch (m_overflow_policy)
+				{
+				case overflow_policy::block:
+					m_depth.fetch_sub(1, std::memory_order_acq_rel);
+					// waiting on our own thread would never end
+					if (std::this_thread::get_id() == m_id.load() || !wait_not_full())
+					{
+						m_rejected.fetch_add(1, std::memory_order_relaxed);
+						return false;
+					}
+					depth = m_depth.fetch_add(1, std::memory_order_acq_rel);
+					continue;
+
+				case overflow_policy::drop_newest:
+					m_depth.fetch_sub(1, std::memory_order_acq_rel);
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+
+				case overflow_policy::drop_oldest:
+				{
+					// the consumer pops under m_pop_lock in this mode, so we may pop too
+					queued_task oldest;
+					bool evicted;
+					{
+						std::lock_guard<std::mutex> lock(m_pop_lock);
+						evicted = m_action_q.try_pop(oldest);
+					}
+
+					if (evicted)
+					{
+						m_depth.fetch_sub(1, std::memory_order_acq_rel);
+						m_dropped.fetch_add(1, std::memory_order_relaxed);
+					}
+
+					// other producers may have filled the room again, check without our own slot
+					depth = m_depth.load(std::memory_order_acquire) - 1;
+					if (evicted || depth < m_capacity)
+						continue;
+
+					// nothing to evict : the counted actions are still being linked by other
+					// producers, or the worker just took them. Drop the new one, not the bound.
+					m_depth.fetch_sub(1, std::memory_order_acq_rel);
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+
+				case overflow_policy::reject:
+					m_depth.fetch_sub(1, std::memory_order_acq_rel);
+					m_rejected.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				break;
+			}
+
+			m_action_q.push(queued_task(std::move(_action)));
+			m_enqueued.fetch_add(1, std::memory_order_relaxed);
+
+			auto peak = m_peak_depth.load(std::memory_order_relaxed);
+			while (depth + 1 > peak && !m_peak_depth.compare_exchange_weak(peak, depth + 1, std::memory_order_relaxed))
+			{
+			}
+
+			return true;
+		}
+
+		// false when the dispatcher stopped while waiting
+		bool wait_not_full()
+		{
+			std::unique_lock<std::mutex> lock(m_not_full_mutex);
+			m_blocked_producers.fetch_add(1);
+			m_not_full_cv.wait(lock, [&]()
+				{
+					return m_depth.load() < m_capacity || m_still_running == false;
+				});
+			m_blocked_producers.fetch_sub(1);
+			return m_still_running;
+		}
+
+		bool pop_action(queued_task& _action)
+		{
+			if (m_overflow_policy != overflow_policy::drop_oldest)
+				return m_action_q.try_pop(_action);
+
+			std::lock_guard<std::mutex> lock(m_pop_lock);
+			return m_action_q.try_pop(_action);
+		}
+
+		void drain()
+		{
+			queued_task action;
+			size_t count = 0;
+			while (m_still_running && pop_action(action))
+			{
+				// a long backlog must not hold the timers back
+				if ((++count % TIMER_CHECK_INTERVAL) == 0)
+					run_timers();
+
+				// seq_cst pairs with m_blocked_producers in wait_not_full()
+				m_depth.fetch_sub(1);
+
+				AFU_INSTRUMENT(auto start = instrument_now_ns();)
+				invoke(action.m_task);
+				AFU_INSTRUMENT(m_metrics.record(action.m_enqueued_ns, start, instrument_now_ns());)
+				action.m_task.reset();
+				m_executed.fetch_add(1, std::memory_order_relaxed);
+
+				if (m_blocked_producers.load() > 0)
+				{
+					std::lock_guard<std::mutex> lock(m_not_full_mutex);
+					m_not_full_cv.notify_one();
+				}
+			}
+		}
+
+		// true when work showed up within the spin budget
+		bool spin()
+		{
+			auto timer_due = m_timers.empty() ? timer_clock::time_point::max() : m_timers.next_deadline();
+			return spin_until(m_thread_config.spin_budget, [&]()
+				{
+					return !m_action_q.empty() || !m_timer_q.empty() || !m_still_running ||
+						(timer_due != timer_clock::time_point::max() && timer_due <= timer_clock::now());
+				});
+		}
+
+		// Sleeps until a producer unparks us or the next timer is due. m_parked and the
+		// queues form a Dekker pair with unpark(), so a push is either seen here or the
+		// producer sees m_parked.
+		void park()
+		{
+			std::unique_lock<std::mutex> lock(m_park_mutex);
+			m_parked.store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (!m_action_q.empty() || !m_timer_q.empty() || !m_still_running)
+			{
+				m_parked.store(false);
+				return;
+			}
+
+			auto wakeup = [&]()
+			{
+				return !m_parked.load();
+			};
+
+			if (m_timers.empty())
+				m_park_cv.wait(lock, wakeup);
+			else
+				m_park_cv.wait_until(lock, m_timers.next_deadline(), wakeup);
+
+			m_parked.store(false);
+		}
+
+		void unpark()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (!m_parked.load())
+				return;
+
+			{
+				std::lock_guard<std::mutex> lock(m_park_mutex);
+				m_parked.store(false);
+			}
+			m_park_cv.notify_one();
+		}
+
+
+		bool invoke(task& _action)
+		{
+			try
+			{
+				_action();
+			}
+			catch (const std::exception&)
 			{
 				return false;
 			}
@@ -166,13 +673,36 @@ namespace afu
 			return true;
 		}
 
-		std::thread m_invoke_thread;
-		std::mutex m_lock_invoke_thread;
-		std::condition_variable m_invoke_thread_cv;
-		std::queue<std::shared_ptr<async_action_context>> m_action_q;
+		static constexpr size_t TIMER_CHECK_INTERVAL = 64;
 
-		std::atomic_bool m_still_running;
-		std::thread::id m_id;
+		std::thread m_invoke_thread;
+		afu::mpsc_queue<queued_task> m_action_q;
+		afu::mpsc_queue<timer_request> m_timer_q;
+		afu::timer_wheel<std::shared_ptr<async_action_context>> m_timers;
+
+		// producer side counters
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_depth{ 0 };
+		std::atomic<size_t> m_peak_depth{ 0 };
+		std::atomic<uint64_t> m_enqueued{ 0 };
+		std::atomic<uint64_t> m_dropped{ 0 };
+		std::atomic<uint64_t> m_rejected{ 0 };
+
+		// consumer side
+		alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> m_executed{ 0 };
+		std::atomic_bool m_parked{ false };
+		std::mutex m_pop_lock;  // overflow_policy::drop_oldest only
+		std::mutex m_park_mutex;
+		std::condition_variable m_park_cv;
+
+		size_t m_capacity = UNBOUNDED;
+		overflow_policy m_overflow_policy = overflow_policy::block;
+		std::atomic<size_t> m_blocked_producers{ 0 };
+		std::mutex m_not_full_mutex;
+		std::condition_variable m_not_full_cv;
+
+		std::atomic_bool m_still_running{ false };
+		std::atomic<std::thread::id> m_id{ std::thread::id() };  // read by blocked producers
+		thread_config m_thread_config;
 
 	};
 	
@@ -0,0 +1,581 @@
+#pragma once
+// Schwartz Liran
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "dispatcher.hpp"
+
+
+namespace afu
+{
+
+	// Dispatcher pool : N worker threads behind the dispatcher interface.
+	// Every worker owns a deque, an idle worker steals from the others. Actions posted
+	// without a key may run in parallel and in any order; actions posted with the same
+	// order key go through one strand and run one at a time in posting order.
+	// Timers run on the wheel of the base dispatcher thread and are handed to the workers
+	// when due, so a slow periodic action may overlap its next run.
+	// set_thread_config() applies to every worker, names get a "-<index>" suffix.
+	// set_capacity() bounds the actions queued on the workers and strands together;
+	// drop_oldest evicts the oldest plain action of a worker before a strand's oldest.
+	// Fired timers are never refused, they count towards the depth and may exceed it.
+	class dispatcher_pool : public dispatcher
+	{
+	public:
+
+		static constexpr size_t DEFAULT_STRAND_COUNT = 256;
+
+	private:
+
+		struct pool_task
+		{
+			queued_task m_task;
+			bool m_is_strand;  // strands count their own actions
+		};
+
+		struct alignas(CACHE_LINE_SIZE) worker
+		{
+			std::mutex m_lock;
+			std::deque<pool_task> m_tasks;
+			std::thread m_thread;
+		};
+
+		class strand;
+
+		struct strand_runner
+		{
+			strand* m_strand;
+
+			explicit strand_runner(strand* _strand) :
+				m_strand(_strand)
+			{}
+
+			strand_runner(strand_runner&& other) noexcept :
+				m_strand(other.m_strand)
+			{
+				other.m_strand = nullptr;
+			}
+
+			~strand_runner()
+			{
+				if (m_strand != nullptr)
+					m_strand->abandon();
+			}
+
+			void operator()()
+			{
+				auto s = m_strand;
+				m_strand = nullptr;
+				s->run();
+			}
+		};
+
+		// Serializes the actions of every key that maps to it. Scheduled on the pool as a
+		// normal task while it has work, re-posts itself after a burst to stay fair.
+		class strand
+		{
+			static constexpr size_t MAX_BURST = 64;
+
+			dispatcher_pool* m_pool;
+			std::mutex m_lock;
+			std::deque<queued_task> m_actions;
+			bool m_scheduled;
+
+		public:
+
+			explicit strand(dispatcher_pool* _pool) :
+				m_pool(_pool),
+				m_scheduled(false)
+			{}
+
+			// true when the strand has to be scheduled on the pool
+			bool push(task&& _action)
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				m_actions.emplace_back(std::move(_action));
+				if (m_scheduled)
+					return false;
+
+				m_scheduled = true;
+				return true;
+			}
+
+			// drop_oldest : hands out the oldest action still waiting
+			bool evict(queued_task& _victim)
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				if (m_actions.empty())
+					return false;
+
+				_victim = std::move(m_actions.front());
+				m_actions.pop_front();
+				return true;
+			}
+
+			// the task that schedules this strand on a worker
+			task runner()
+			{
+				return task(strand_runner(this));
+			}
+
+			// The runner was destroyed without running : the queued actions reset themselves
+			// through on_dropped() and the strand may be scheduled again
+			void abandon()
+			{
+				std::deque<queued_task> dropped;
+				{
+					std::lock_guard<std::mutex> lock(m_lock);
+					dropped.swap(m_actions);
+					m_scheduled = false;
+				}
+				m_pool->m_queued.fetch_sub(dropped.size());
+			}
+
+			void run()
+			{
+				for (size_t i = 0; i < MAX_BURST; ++i)
+				{
+					queued_task action;
+					{
+						std::lock_guard<std::mutex> lock(m_lock);
+						if (m_actions.empty())
+						{
+							m_scheduled = false;
+							return;
+						}
+						action = std::move(m_actions.front());
+						m_actions.pop_front();
+					}
+					m_pool->execute(action);
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(m_lock);
+					if (m_actions.empty())
+					{
+						m_scheduled = false;
+						return;
+					}
+				}
+				m_pool->submit({ queued_task(runner()), true });
+			}
+		};
+
+		std::vector<std::unique_ptr<worker>> m_workers;
+		std::vector<std::unique_ptr<strand>> m_strands;
+
+		std::atomic<size_t> m_next_worker{ 0 };
+		std::atomic<size_t> m_pending{ 0 };  // tasks in the worker deques
+		std::atomic<size_t> m_sleepers{ 0 };
+		std::atomic<uint64_t> m_enqueued{ 0 };
+		std::atomic<uint64_t> m_executed{ 0 };
+		std::atomic_bool m_running{ false };
+
+		std::mutex m_idle_lock;
+		std::condition_variable m_idle_cv;
+
+		// accepted actions that did not run yet, strands included
+		std::atomic<size_t> m_queued{ 0 };
+		std::atomic<size_t> m_peak_queued{ 0 };
+		std::atomic<uint64_t> m_dropped{ 0 };
+		std::atomic<uint64_t> m_rejected{ 0 };
+		std::atomic<size_t> m_blocked_producers{ 0 };
+		std::mutex m_not_full_lock;
+		std::condition_variable m_not_full_cv;
+
+		struct worker_identity
+		{
+			const dispatcher_pool* m_pool;
+			size_t m_index;
+		};
+
+		static worker_identity& this_worker()
+		{
+			thread_local worker_identity identity{ nullptr, 0 };
+			return identity;
+		}
+
+	public:
+
+		explicit dispatcher_pool(size_t _threads = std::thread::hardware_concurrency(), size_t _strands = DEFAULT_STRAND_COUNT)
+		{
+			if (_threads == 0)
+				_threads = 1;
+
+			if (_strands == 0)
+				_strands = 1;
+
+			for (size_t i = 0; i < _threads; ++i)
+				m_workers.emplace_back(new worker());
+
+			for (size_t i = 0; i < _strands; ++i)
+				m_strands.emplace_back(new strand(this));
+		}
+
+		dispatcher_pool(const dispatcher_pool& other) = delete;
+
+		virtual ~dispatcher_pool()
+		{
+			stop();
+
+			// strand runners left behind refer to the strands, drop them while those live
+			for (auto& w : m_workers)
+			{
+				std::deque<pool_task> left;
+				{
+					std::lock_guard<std::mutex> lock(w->m_lock);
+					left.swap(w->m_tasks);
+				}
+			}
+		}
+
+		using dispatcher::begin_invoke;
+		using dispatcher::add_list_action;
+
+		virtual size_t add_list_action(const std::vector<std::shared_ptr<async_action_context>>& _action) override
+		{
+			size_t accepted = 0;
+			for (const auto& ac : _action)
+				accepted += enqueue(make_task(ac)) ? 1 : 0;
+
+			return accepted;
+		}
+
+		virtual size_t add_list_action(const std::vector<ordered_action>& _action) override
+		{
+			size_t accepted = 0;
+			for (const auto& ac : _action)
+				accepted += enqueue(make_task(ac.second), ac.first) ? 1 : 0;
+
+			return accepted;
+		}
+
+		virtual void begin_invoke() override
+		{
+			// submit() already wakes a worker
+		}
+
+		virtual dispatcher_stats get_stats() override
+		{
+			dispatcher_stats stats{};
+			stats.enqueued = m_enqueued.load(std::memory_order_relaxed);
+			stats.executed = m_executed.load(std::memory_order_relaxed);
+			stats.dropped = m_dropped.load(std::memory_order_relaxed);
+			stats.rejected = m_rejected.load(std::memory_order_relaxed);
+			stats.depth = m_queued.load(std::memory_order_relaxed);
+			stats.peak_depth = m_peak_queued.load(std::memory_order_relaxed);
+			return stats;
+		}
+
+		virtual void start() override
+		{
+			if (m_running.exchange(true))
+				return;
+
+			for (size_t i = 0; i < m_workers.size(); ++i)
+			{
+				m_workers[i]->m_thread = std::thread([this, i]()
+					{
+						this_worker() = { this, i };
+						apply_thread_config(indexed_thread_config(get_thread_config(), i));
+						run_worker(i);
+					});
+			}
+
+			// timer thread, it keeps the plain name
+			dispatcher::start();
+		}
+
+		virtual void stop() override
+		{
+			dispatcher::stop();
+
+			m_running = false;
+			{
+				std::lock_guard<std::mutex> lock(m_idle_lock);
+			}
+			m_idle_cv.notify_all();
+			{
+				std::lock_guard<std::mutex> lock(m_not_full_lock);
+			}
+			m_not_full_cv.notify_all();
+
+			for (auto& w : m_workers)
+			{
+				if (w->m_thread.joinable() && w->m_thread.get_id() != std::this_thread::get_id())
+					w->m_thread.join();
+			}
+		}
+
+		virtual void join() override
+		{
+			dispatcher::join();
+			for (auto& w : m_workers)
+			{
+				if (w->m_thread.joinable())
+					w->m_thread.join();
+			}
+		}
+
+		size_t size() const noexcept
+		{
+			return m_workers.size();
+		}
+
+	protected:
+
+		virtual bool enqueue(task&& _task) override
+		{
+			if (!admit())
+				return false;
+
+			m_enqueued.fetch_add(1, std::memory_order_relaxed);
+			submit({ queued_task(std::move(_task)), false });
+			return true;
+		}
+
+		virtual bool enqueue(task&& _task, size_t _order_key) override
+		{
+			if (!admit())
+				return false;
+
+			m_enqueued.fetch_add(1, std::memory_order_relaxed);
+			auto& s = m_strands[_order_key % m_strands.size()];
+			if (s->push(std::move(_task)))
+				submit({ queued_task(s->runner()), true });
+
+			return true;
+		}
+
+		// Timers skip the overflow policy like on a single dispatcher, but count as queued
+		virtual void fire_timer(const std::shared_ptr<async_action_context>& _action) override
+		{
+			record_peak(m_queued.fetch_add(1, std::memory_order_acq_rel) + 1);
+			m_enqueued.fetch_add(1, std::memory_order_relaxed);
+			submit({ queued_task(make_task(_action)), false });
+		}
+
+	private:
+
+		// Counts a new action in, applying the overflow policy when at capacity
+		bool admit()
+		{
+			auto capacity = get_capacity();
+			auto depth = m_queued.fetch_add(1, std::memory_order_acq_rel);
+			while (capacity != UNBOUNDED && depth >= capacity)
+			{
+				switch (get_overflow_policy())
+				{
+				case overflow_policy::block:
+					m_queued.fetch_sub(1, std::memory_order_acq_rel);
+					// a worker waiting for room may be the one that has to make it
+					if (this_worker().m_pool == this || !wait_not_full())
+					{
+						m_rejected.fetch_add(1, std::memory_order_relaxed);
+						return false;
+					}
+					depth = m_queued.fetch_add(1, std::memory_order_acq_rel);
+					continue;
+
+				case overflow_policy::drop_newest:
+					m_queued.fetch_sub(1, std::memory_order_acq_rel);
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+
+				case overflow_policy::drop_oldest:
+				{
+					bool evicted = evict_oldest();
+					if (evicted)
+					{
+						m_queued.fetch_sub(1, std::memory_order_acq_rel);
+						m_dropped.fetch_add(1, std::memory_order_relaxed);
+					}
+
+					// other producers may have filled the room again, check without our own slot
+					depth = m_queued.load(std::memory_order_acquire) - 1;
+					if (evicted || depth < capacity)
+						continue;
+
+					// everything counted is already running, drop the new one
+					m_queued.fetch_sub(1, std::memory_order_acq_rel);
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+
+				case overflow_policy::reject:
+					m_queued.fetch_sub(1, std::memory_order_acq_rel);
+					m_rejected.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				break;
+			}
+
+			record_peak(depth + 1);
+			return true;
+		}
+
+		void record_peak(size_t _depth)
+		{
+			auto peak = m_peak_queued.load(std::memory_order_relaxed);
+			while (_depth > peak && !m_peak_queued.compare_exchange_weak(peak, _depth, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		// false when the pool stopped while waiting
+		bool wait_not_full()
+		{
+			std::unique_lock<std::mutex> lock(m_not_full_lock);
+			m_blocked_producers.fetch_add(1);
+			m_not_full_cv.wait(lock, [&]()
+				{
+					return m_queued.load() < get_capacity() || !m_running;
+				});
+			m_blocked_producers.fetch_sub(1);
+			return m_running;
+		}
+
+		// The victim is destroyed outside the locks, its action may reset itself there
+		bool evict_oldest()
+		{
+			queued_task victim;
+			size_t first = m_next_worker.load(std::memory_order_relaxed);
+			for (size_t i = 0; i < m_workers.size(); ++i)
+			{
+				auto& w = *m_workers[(first + i) % m_workers.size()];
+				std::lock_guard<std::mutex> lock(w.m_lock);
+				auto it = std::find_if(w.m_tasks.begin(), w.m_tasks.end(), [](const pool_task& _task)
+					{
+						return !_task.m_is_strand;
+					});
+
+				if (it != w.m_tasks.end())
+				{
+					victim = std::move(it->m_task);
+					w.m_tasks.erase(it);
+					m_pending.fetch_sub(1, std::memory_order_acq_rel);
+					return true;
+				}
+			}
+
+			for (auto& s : m_strands)
+			{
+				if (s->evict(victim))
+					return true;
+			}
+			return false;
+		}
+
+		void submit(pool_task _task)
+		{
+			// a worker keeps its own follow-up work local, others spread round robin
+			const auto& self = this_worker();
+			size_t index = self.m_pool == this ? self.m_index : m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+			{
+				std::lock_guard<std::mutex> lock(m_workers[index]->m_lock);
+				m_workers[index]->m_tasks.push_back(std::move(_task));
+			}
+
+			m_pending.fetch_add(1);
+
+			// pairs with the m_sleepers increment in run_worker()
+			if (m_sleepers.load() > 0)
+			{
+				std::lock_guard<std::mutex> lock(m_idle_lock);
+				m_idle_cv.notify_one();
+			}
+		}
+
+		bool take(size_t _self, pool_task& _task)
+		{
+			{
+				auto& own = *m_workers[_self];
+				std::lock_guard<std::mutex> lock(own.m_lock);
+				if (!own.m_tasks.empty())
+				{
+					_task = std::move(own.m_tasks.front());
+					own.m_tasks.pop_front();
+					return true;
+				}
+			}
+
+			// steal the newest task of a sibling, the owner keeps its oldest ones
+			for (size_t i = 1; i < m_workers.size(); ++i)
+			{
+				auto& victim = *m_workers[(_self + i) % m_workers.size()];
+				std::lock_guard<std::mutex> lock(victim.m_lock);
+				if (!victim.m_tasks.empty())
+				{
+					_task = std::move(victim.m_tasks.back());
+					victim.m_tasks.pop_back();
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void run_worker(size_t _self)
+		{
+			pool_task next;
+			while (m_running)
+			{
+				if (take(_self, next))
+				{
+					m_pending.fetch_sub(1, std::memory_order_acq_rel);
+					if (next.m_is_strand)
+						invoke(next.m_task.m_task);
+					else
+						execute(next.m_task);
+
+					next.m_task.m_task.reset();
+					continue;
+				}
+
+				if (spin_until(get_thread_config().spin_budget, [&]() { return m_pending.load() > 0 || !m_running; }))
+					continue;
+
+				std::unique_lock<std::mutex> lock(m_idle_lock);
+				m_sleepers.fetch_add(1);
+				m_idle_cv.wait(lock, [&]()
+					{
+						return m_pending.load() > 0 || !m_running;
+					});
+				m_sleepers.fetch_sub(1);
+			}
+		}
+
+		static void invoke(task& _action)
+		{
+			try
+			{
+				_action();
+			}
+			catch (const std::exception&)
+			{
+			}
+		}
+
+		void execute(queued_task& _action)
+		{
+			// seq_cst pairs with m_blocked_producers in wait_not_full()
+			m_queued.fetch_sub(1);
+			if (m_blocked_producers.load() > 0)
+			{
+				std::lock_guard<std::mutex> lock(m_not_full_lock);
+				m_not_full_cv.notify_one();
+			}
+
+			AFU_INSTRUMENT(auto start = instrument_now_ns();)
+			invoke(_action.m_task);
+			AFU_INSTRUMENT(m_metrics.record(_action.m_enqueued_ns, start, instrument_now_ns());)
+			m_executed.fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
+}
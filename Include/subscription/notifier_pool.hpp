@@ -0,0 +1,73 @@
+#pragma once
+// Schwartz Liran
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "dispatcher.hpp"
+
+
+namespace afu
+{
+
+	// Notifier pool : fixed set of dispatcher threads shared by subscribers for their fan-out,
+	// so the thread count does not grow with the number of topics.
+	// Every subscriber is pinned to one worker, which keeps its samples in order.
+	// Latency sensitive topics get a pool of their own with a spinning / pinned thread_config.
+	class notifier_pool
+	{
+	private:
+
+		std::vector<std::unique_ptr<afu::dispatcher>> m_workers;
+		std::atomic<size_t> m_next;
+
+	public:
+
+		static constexpr size_t MAX_DEFAULT_THREADS = 4;
+
+		explicit notifier_pool(size_t _threads, const thread_config& _config = thread_config()) :
+			m_next(0)
+		{
+			if (_threads == 0)
+				_threads = 1;
+
+			for (size_t i = 0; i < _threads; ++i)
+			{
+				m_workers.emplace_back(new afu::dispatcher());
+				m_workers.back()->set_thread_config(indexed_thread_config(_config, i));
+				m_workers.back()->start();
+			}
+		}
+
+		notifier_pool(const notifier_pool& other) = delete;
+
+		~notifier_pool()
+		{
+			for (auto& worker : m_workers)
+				worker->stop();
+		}
+
+		// Round robin worker for a new subscriber
+		afu::dispatcher* assign()
+		{
+			return m_workers[m_next.fetch_add(1) % m_workers.size()].get();
+		}
+
+		size_t size() const noexcept
+		{
+			return m_workers.size();
+		}
+
+		// Process wide pool used by subscribers that were not given one
+		static std::shared_ptr<notifier_pool> default_pool()
+		{
+			static std::shared_ptr<notifier_pool> pool = std::make_shared<notifier_pool>(
+				std::min<size_t>(std::max<size_t>(std::thread::hardware_concurrency(), 1), MAX_DEFAULT_THREADS));
+			return pool;
+		}
+	};
+
+}
@@ -1,12 +1,22 @@
 #pragma once
+#include <algorithm>
 #include <iostream>
+#include <cstring>
+#include <functional>
 #include <mutex>
 #include <string>
 #include <stdexcept>
 #include <map>
 #include <vector>
+#include <utils/binary_codec.hpp>
 #include <utils/collection.hpp>
+#include <utils/instrumentation.hpp>
+#include <utils/seqlock.hpp>
+#include <utils/snapshot.hpp>
+#include <utils/span.hpp>
+#include "delivery_policy.hpp"
 #include "dispatcher.hpp"
+#include "notifier_pool.hpp"
 
 
 namespace afu
@@ -16,14 +26,18 @@ namespace afu
 
 
 
-	class subscription_data :
-		public std::enable_shared_from_this<subscription_data>
+	// No enable_shared_from_this : its weak reference would hold a pooled object's
+	// control block until the object is handed out again
+	class subscription_data
 	{
 	private:
 
 		byte_vector m_buffer;
 
 	public:
+
+		AFU_INSTRUMENT(std::uint64_t m_publish_ns = 0;)
+
 		subscription_data() : m_buffer(0){}
 
 
@@ -62,6 +76,28 @@ namespace afu
 			std::memcpy(m_buffer.data(), &_val, sizeof(T));
 		}
 
+		// Portable payload : the fields of Layout (afu::struct_layout) in wire byte order,
+		// packed straight into the buffer. Readable on a node of the other endianness.
+		template<typename Layout>
+		void encode(const typename Layout::struct_type& _val)
+		{
+			m_buffer.resize(Layout::wire_size);
+			Layout::pack(_val, m_buffer.data());
+		}
+
+		template<typename Layout>
+		void decode(typename Layout::struct_type& _val) const
+		{
+			if (m_buffer.size() != Layout::wire_size)
+			{
+				throw std::invalid_argument(
+					"Buffer size (" + std::to_string(m_buffer.size()) +
+					") does not match the layout wire size (" + std::to_string(Layout::wire_size) + ")");
+			}
+
+			Layout::unpack(m_buffer.data(), _val);
+		}
+
 		byte_vector& get_ref_buffer()
 		{
 			return m_buffer;
@@ -72,10 +108,15 @@ namespace afu
 			return m_buffer;
 		}
 
+		const unsigned char* data() const noexcept { return m_buffer.data(); }
+
 		size_t size() const noexcept { return m_buffer.size(); }
 
 		void clear() noexcept { m_buffer.clear(); }
 
+		// keeps the capacity, used when a pooled buffer is reused
+		void resize(size_t _data_size) { m_buffer.resize(_data_size); }
+
 		//copyble read 
 		void read(void* _buffer, size_t _size)
 		{
@@ -109,6 +150,217 @@ namespace afu
 	};
 
 
+	// Recycling pool of subscription_data objects.
+	// acquire() hands out a pooled object together with the memory of its shared_ptr
+	// control block; both go back to the free list once the last owner drops it, so
+	// steady-state publishing reuses buffers and allocates nothing.
+	class subscription_data_pool
+	{
+	public:
+
+		struct statistics
+		{
+			size_t pool_size;        // buffers waiting in the free list
+			size_t in_use;           // buffers currently owned by someone
+			size_t high_water_mark;  // max buffers in use at the same time
+			size_t miss_count;       // acquire() calls that had to allocate
+			size_t acquire_count;
+		};
+
+		static constexpr size_t DEFAULT_MAX_CACHED = 1024;
+
+	private:
+
+		// An object and the control block memory it last used (nullptr before its first use)
+		struct pooled_entry
+		{
+			subscription_data* m_data;
+			void* m_block;
+			size_t m_block_size;
+		};
+
+		// Outstanding buffers keep it alive, releasing after the pool died still recycles
+		struct pool_state
+		{
+			std::mutex m_lock;
+			std::vector<pooled_entry> m_free;
+			size_t m_max_cached;
+			size_t m_in_use = 0;
+			size_t m_high_water_mark = 0;
+			size_t m_miss_count = 0;
+			size_t m_acquire_count = 0;
+
+			explicit pool_state(size_t _max_cached) :
+				m_max_cached(_max_cached)
+			{
+				m_free.reserve(_max_cached);
+			}
+
+			~pool_state()
+			{
+				for (auto& entry : m_free)
+					destroy(entry);
+			}
+
+			static void destroy(const pooled_entry& _entry)
+			{
+				delete _entry.m_data;
+				::operator delete(_entry.m_block);
+			}
+
+			void release(const pooled_entry& _entry)
+			{
+				{
+					std::lock_guard<std::mutex> lock(m_lock);
+					--m_in_use;
+					if (m_free.size() < m_max_cached)
+					{
+						m_free.push_back(_entry);
+						return;
+					}
+				}
+				destroy(_entry);
+			}
+		};
+
+		// The object goes back with its control block, see block_allocator
+		struct pool_deleter
+		{
+			void operator()(subscription_data*) const noexcept {}
+		};
+
+		// Allocates the control block of one acquire() from the recycled block of its
+		// entry, and releases the entry once the last strong and weak owner is gone
+		template<typename U>
+		struct block_allocator
+		{
+			using value_type = U;
+
+			std::shared_ptr<pool_state> m_state;
+			pooled_entry m_entry;
+
+			block_allocator(const std::shared_ptr<pool_state>& _state, const pooled_entry& _entry) noexcept :
+				m_state(_state),
+				m_entry(_entry)
+			{}
+
+			template<typename V>
+			block_allocator(const block_allocator<V>& other) noexcept :
+				m_state(other.m_state),
+				m_entry(other.m_entry)
+			{}
+
+			U* allocate(size_t _count)
+			{
+				static_assert(alignof(U) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "control block over-aligned");
+
+				auto size = sizeof(U) * _count;
+				if (m_entry.m_block == nullptr || m_entry.m_block_size != size)
+				{
+					::operator delete(m_entry.m_block);
+					m_entry.m_block = ::operator new(size);
+					m_entry.m_block_size = size;
+				}
+				return static_cast<U*>(m_entry.m_block);
+			}
+
+			void deallocate(U* _block, size_t _count) noexcept
+			{
+				m_state->release({ m_entry.m_data, _block, sizeof(U) * _count });
+			}
+
+			template<typename V>
+			bool operator==(const block_allocator<V>& other) const noexcept
+			{
+				return m_entry.m_data == other.m_entry.m_data;
+			}
+
+			template<typename V>
+			bool operator!=(const block_allocator<V>& other) const noexcept
+			{
+				return !(*this == other);
+			}
+		};
+
+		std::shared_ptr<pool_state> m_state;
+
+	public:
+
+		explicit subscription_data_pool(size_t _initial_size = 0, size_t _max_cached = DEFAULT_MAX_CACHED) :
+			m_state(std::make_shared<pool_state>(_max_cached < _initial_size ? _initial_size : _max_cached))
+		{
+			reserve(_initial_size, 0);
+		}
+
+		subscription_data_pool(const subscription_data_pool& other) = delete;
+
+		// Preallocate _count buffers of _data_size bytes
+		void reserve(size_t _count, size_t _data_size)
+		{
+			std::lock_guard<std::mutex> lock(m_state->m_lock);
+			while (m_state->m_free.size() < _count && m_state->m_free.size() < m_state->m_max_cached)
+				m_state->m_free.push_back({ new subscription_data(_data_size), nullptr, 0 });
+		}
+
+		std::shared_ptr<subscription_data> acquire(size_t _data_size)
+		{
+			pooled_entry entry{ nullptr, nullptr, 0 };
+			{
+				std::lock_guard<std::mutex> lock(m_state->m_lock);
+				++m_state->m_acquire_count;
+				if (++m_state->m_in_use > m_state->m_high_water_mark)
+					m_state->m_high_water_mark = m_state->m_in_use;
+
+				if (!m_state->m_free.empty())
+				{
+					entry = m_state->m_free.back();
+					m_state->m_free.pop_back();
+				}
+				else
+				{
+					++m_state->m_miss_count;
+				}
+			}
+
+			std::shared_ptr<subscription_data> res;
+			try
+			{
+				if (entry.m_data == nullptr)
+					entry.m_data = new subscription_data(_data_size);
+
+				res = std::shared_ptr<subscription_data>(entry.m_data, pool_deleter{}, block_allocator<subscription_data>(m_state, entry));
+			}
+			catch (...)
+			{
+				// only allocations throw, a recycled block is never released here
+				{
+					std::lock_guard<std::mutex> lock(m_state->m_lock);
+					--m_state->m_in_use;
+				}
+				delete entry.m_data;
+				throw;
+			}
+
+			// from here on the control block owns the buffer, also if resize throws
+			res->resize(_data_size);
+			return res;
+		}
+
+		statistics get_statistics() const
+		{
+			std::lock_guard<std::mutex> lock(m_state->m_lock);
+			return { m_state->m_free.size(), m_state->m_in_use, m_state->m_high_water_mark, m_state->m_miss_count, m_state->m_acquire_count };
+		}
+
+		size_t pool_size() const { return get_statistics().pool_size; }
+
+		size_t high_water_mark() const { return get_statistics().high_water_mark; }
+
+		size_t miss_count() const { return get_statistics().miss_count; }
+
+	};
+
+
 	class rowdata_async_action:
 		public afu::async_action_context
 	{
@@ -141,65 +393,285 @@ namespace afu
 	};
 
 
+	using subscription_callback = std::function<void(const std::shared_ptr<subscription_data>&)>;
+	using subscription_batch = afu::span<const std::shared_ptr<subscription_data>>;
+	using subscription_batch_callback = std::function<void(subscription_batch)>;
+
+	// Carries every sample of one notify round, shared by all batched subscriptions
+	class rowdata_batch_async_action :
+		public afu::async_action_context
+	{
+		subscription_callback m_callback;
+		subscription_batch_callback m_batch_callback;
+		std::shared_ptr<const std::vector<std::shared_ptr<subscription_data>>> m_data;
+
+	public:
+
+		rowdata_batch_async_action(subscription_callback _callback, subscription_batch_callback _batch_callback,
+			std::shared_ptr<const std::vector<std::shared_ptr<subscription_data>>> _data) :
+			m_callback(_callback),
+			m_batch_callback(_batch_callback),
+			m_data(_data)
+		{}
+
+		virtual void run_action() override
+		{
+			try
+			{
+				if (m_batch_callback != nullptr)
+				{
+					m_batch_callback(subscription_batch(*m_data));
+					return;
+				}
+
+				for (const auto& data : *m_data)
+					m_callback(data);
+			}
+			catch (const std::exception&)
+			{
+				throw std::runtime_error("callback exception\n");
+			}
+		}
+	};
+
+
+	// Conflating action for delivery_policy::latest.
+	// Lives as long as the subscription and is queued at most once, every new sample
+	// replaces the one still waiting, so a slow dispatcher holds one update per topic.
+	class rowdata_latest_async_action :
+		public afu::async_action_context
+	{
+		subscription_callback m_callback;
+		std::mutex m_lock;
+		std::shared_ptr<subscription_data> m_data;
+		bool m_pending;
+
+	public:
+
+		rowdata_latest_async_action(subscription_callback _callback) :
+			m_callback(_callback),
+			m_pending(false)
+		{}
+
+		// true when the action has to be queued on the dispatcher
+		bool update(const std::shared_ptr<subscription_data>& _data)
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_data = _data;
+			if (m_pending)
+				return false;
+
+			m_pending = true;
+			return true;
+		}
+
+		// dropped by a bounded dispatcher : the next update() queues us again
+		virtual void on_dropped() override
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_pending = false;
+		}
+
+		virtual void run_action() override
+		{
+			std::shared_ptr<subscription_data> data;
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				data = std::move(m_data);
+				m_pending = false;
+			}
+
+			if (data == nullptr)
+				return;
+
+			try
+			{
+				m_callback(data);
+			}
+			catch (const std::exception&)
+			{
+				throw std::runtime_error("callback exception\n");
+			}
+		}
+	};
+
+	// Counters and histogram are zero unless built with AFU_ENABLE_INSTRUMENTATION,
+	// published counts in any build. Diff two snapshots for rates.
+	struct subscriber_metrics_snapshot
+	{
+		std::uint64_t timestamp_ns;
+		std::uint64_t published;
+		std::uint64_t deliveries;       // actions handed to subscriber dispatchers
+		std::uint64_t callbacks;        // samples that went through a callback
+		histogram_snapshot end_to_end;  // write() to end of callback
+	};
+
+
+	// Where subscriber fan-out runs
+	enum class notify_mode
+	{
+		pooled,        // on a worker of a shared notifier_pool
+		inline_notify  // on the publishing thread, inside write()
+	};
+
+
 	class  subscriber : 
 		public std::enable_shared_from_this<subscriber>
 	{
 	private:
 
 		static constexpr int POOL_BUFFER_SIZE = 10;
+		static constexpr size_t HISTORY_SIZE = 16;
 
-		std::shared_ptr<afu::cyclicBuffer<subscription_data>> m_pool_buffer;
-		std::queue<std::shared_ptr<subscription_data>> m_data_to_send;
+		// newest HISTORY_SIZE samples for get_history(), shared with the deliveries rather
+		// than copied. Pushed and read under m_data_notify_mutex, as overwrite mode needs.
+		afu::spsc_ring<std::shared_ptr<subscription_data>> m_history;
+		std::vector<std::shared_ptr<subscription_data>> m_data_to_send;
+		std::vector<std::shared_ptr<subscription_data>> m_data_in_notify;
+		subscription_data_pool m_data_pool;
 
 		size_t m_data_size;
 
-		std::map<std::thread::id, std::pair< std::shared_ptr<afu::dispatcher>, std::function<void(const std::shared_ptr<subscription_data>&)>>> m_subscription_map;
+		// newest sample, readable without m_data_notify_mutex
+		afu::seqlock_buffer m_latest;
+
+		struct subscription_entry
+		{
+			subscription_id m_id;
+			std::shared_ptr<afu::dispatcher> m_disp;
+			subscription_callback m_callback;
+			subscription_batch_callback m_batch_callback;
+			delivery_policy m_policy;
+			std::shared_ptr<rowdata_latest_async_action> m_latest_action;
+			size_t m_order_key;  // keeps this subscription in order on a dispatcher_pool
+		};
+
+		// copy-on-write, notify() walks a snapshot without taking a lock
+		afu::snapshot_ptr<std::vector<subscription_entry>> m_subscriptions;
+		subscription_id m_last_id = 0;
 
 		std::condition_variable m_data_notify_cv;
 		std::mutex m_data_notify_mutex;
-		std::thread m_data_notify_th;
-		
-		bool m_is_runnning;
-		bool m_need_update;
+
+		// Queued on the notifier worker, at most once at a time per subscriber
+		class notify_async_action :
+			public afu::async_action_context
+		{
+			subscriber* m_owner;
+
+		public:
+
+			notify_async_action(subscriber* _owner) :
+				m_owner(_owner)
+			{}
+
+			virtual void run_action() override
+			{
+				m_owner->notify();
+			}
+
+			virtual void on_dropped() override
+			{
+				m_owner->cancel_notify();
+			}
+		};
+
+		std::shared_ptr<notifier_pool> m_notifier_pool;
+		afu::dispatcher* m_notifier;
+		std::shared_ptr<notify_async_action> m_notify_action;
+		bool m_notify_scheduled;
+
+		// shared with the wrapped callbacks, which may run after the subscriber is gone
+		AFU_INSTRUMENT(std::shared_ptr<subscriber_metrics> m_metrics = std::make_shared<subscriber_metrics>();)
 
 
 	public:
 
-		subscriber(size_t _data_size):
-			m_pool_buffer(new afu::cyclicBuffer<subscription_data>(POOL_BUFFER_SIZE)),
+		subscriber(size_t _data_size) :
+			subscriber(_data_size, notifier_pool::default_pool())
+		{}
+
+		subscriber(size_t _data_size, notify_mode _mode) :
+			subscriber(_data_size, _mode == notify_mode::pooled ? notifier_pool::default_pool() : nullptr)
+		{}
+
+		// _pool == nullptr notifies inline on the publishing thread
+		subscriber(size_t _data_size, std::shared_ptr<notifier_pool> _pool):
+			m_history(HISTORY_SIZE, afu::ring_mode::overwrite),
+			m_data_pool(POOL_BUFFER_SIZE),
 			m_data_size(_data_size),
-			m_is_runnning(false),
-			m_need_update(false)
+			m_latest(_data_size),
+			m_notifier_pool(_pool),
+			m_notifier(_pool == nullptr ? nullptr : _pool->assign()),
+			m_notify_action(std::make_shared<notify_async_action>(this)),
+			m_notify_scheduled(false)
 		{
-			m_data_notify_th = std::thread([&]()
-				{
-					m_is_runnning = true;
-					while (m_is_runnning)
-					{
-						notify();
-					}
-				}
-			);
 		}
 
 		subscriber(const subscriber& other) = delete;
 
+		// Waits for a fan-out that is still queued or running
+		virtual ~subscriber()
+		{
+			std::unique_lock<std::mutex> lock(m_data_notify_mutex);
+			m_data_notify_cv.wait(lock, [&]()
+				{
+					return !m_notify_scheduled;
+				});
+		}
 
-		virtual void subscribe(afu::dispatcher* _disp, std::function<void(const std::shared_ptr<subscription_data>&)> _func)
+		size_t data_size() const noexcept
 		{
-			if (_disp == nullptr)
-				throw std::runtime_error("_disp == nullptr");
+			return m_data_size;
+		}
+
 
+		// Any number of callbacks may be registered on the same dispatcher, also before it started
+		virtual subscription_id subscribe(afu::dispatcher* _disp, subscription_callback _func, delivery_policy _policy = delivery_policy::each)
+		{
 			if (_func == nullptr)
-				throw std::runtime_error("_disp == nullptr");
+				throw std::runtime_error("_func == nullptr");
 
-			std::shared_ptr<afu::dispatcher> shared_disp(_disp, [](afu::dispatcher*) {});
-			auto disp_id = _disp->get_id();
-			if (m_subscription_map.find(disp_id) == m_subscription_map.end())
-			{
-				m_subscription_map[disp_id] = { shared_disp, _func };
-			}
-			
+			AFU_INSTRUMENT(_func = instrument_callback(_func);)
+
+			std::shared_ptr<rowdata_latest_async_action> latest_action;
+			if (_policy == delivery_policy::latest)
+				latest_action = std::make_shared<rowdata_latest_async_action>(_func);
+
+			return add_subscription(_disp, { 0, nullptr, _func, nullptr, _policy, latest_action, 0 });
+		}
+
+		// _func gets every sample pending at notify time in one call
+		virtual subscription_id subscribe_batch(afu::dispatcher* _disp, subscription_batch_callback _func)
+		{
+			if (_func == nullptr)
+				throw std::runtime_error("_func == nullptr");
+
+			AFU_INSTRUMENT(_func = instrument_batch_callback(_func);)
+
+			return add_subscription(_disp, { 0, nullptr, nullptr, _func, delivery_policy::batched, nullptr, 0 });
+		}
+
+		// Actions already queued on the dispatcher still run
+		virtual bool unsubscribe(subscription_id _id)
+		{
+			return m_subscriptions.update([&](std::vector<subscription_entry>& _entries)
+				{
+					for (auto it = _entries.begin(); it != _entries.end(); ++it)
+					{
+						if (it->m_id == _id)
+						{
+							_entries.erase(it);
+							return true;
+						}
+					}
+					return false;
+				});
+		}
+
+		size_t subscription_count() const
+		{
+			return m_subscriptions.load()->size();
 		}
 
 		template<typename T>
@@ -208,61 +680,272 @@ namespace afu
 			if (sizeof(T) != m_data_size)
 				throw std::invalid_argument("sizeof(T) != m_data_size");
 			
-			auto v = std::make_shared<subscription_data>(sizeof(T));
+			auto v = m_data_pool.acquire(sizeof(T));
 			v->write(_val);
+			AFU_INSTRUMENT(v->m_publish_ns = instrument_now_ns();)
+			bool schedule = false;
 			{
 				std::lock_guard<std::mutex> lock(m_data_notify_mutex);
-				m_pool_buffer->push(*v);
-				m_data_to_send.push(v);
+				m_history.try_push(v);
+				m_latest.store(v->get_ref_buffer().data(), sizeof(T));
+				m_data_to_send.push_back(v);
+				schedule = !m_notify_scheduled;
+				m_notify_scheduled = true;
 			}
-			m_need_update = true;
-			m_data_notify_cv.notify_one();
+
+			if (!schedule)
+				return;
+
+			if (m_notifier == nullptr)
+				notify();
+			else
+				m_notifier->begin_invoke(m_notify_action);
 		}
 
+	private:
+
+		// Hands every pending sample to the subscribed dispatchers, until none is left.
+		// Only one caller at a time: whoever flipped m_notify_scheduled.
 		void notify()
 		{
-			std::unique_lock<std::mutex> lock(m_data_notify_mutex);
-			m_data_notify_cv.wait(lock, [&]()
+			try
+			{
+				while (true)
 				{
-					return m_need_update && (m_data_to_send.size() > 0);
-				});
-			
-			lock.unlock();
-			while (!m_data_to_send.empty())
+					{
+						std::lock_guard<std::mutex> lock(m_data_notify_mutex);
+						if (m_data_to_send.empty())
+						{
+							m_notify_scheduled = false;
+							m_data_notify_cv.notify_all();
+							return;
+						}
+						m_data_in_notify.swap(m_data_to_send);
+					}
+
+					deliver();
+				}
+			}
+			catch (...)
+			{
+				// the samples in flight are lost, the ones still waiting go with the next write()
+				cancel_notify();
+				throw;
+			}
+		}
+
+		// The scheduled notify() ended early or was dropped by the notifier. A flag left
+		// set would stop write() from scheduling again and block ~subscriber for good.
+		void cancel_notify() noexcept
+		{
+			std::lock_guard<std::mutex> lock(m_data_notify_mutex);
+			m_data_in_notify.clear();
+			m_notify_scheduled = false;
+			m_data_notify_cv.notify_all();
+		}
+
+		void deliver()
+		{
+			std::shared_ptr<const std::vector<std::shared_ptr<subscription_data>>> batch;
+			std::vector<std::pair<afu::dispatcher*, afu::dispatcher::ordered_action>> batch_actions;
+
+			auto subscriptions = m_subscriptions.load();
+			for (const auto& entry : *subscriptions)
 			{
-				auto subData =  m_data_to_send.front();
-				m_data_to_send.pop();
-				for (const auto& disp : m_subscription_map)
+				if (entry.m_policy == delivery_policy::batched)
 				{
-					std::shared_ptr<rowdata_async_action> ac = std::make_shared<rowdata_async_action >(disp.second.second, subData);
-					disp.second.first->begin_invoke(ac);
+					if (batch == nullptr)
+						batch = std::make_shared<const std::vector<std::shared_ptr<subscription_data>>>(m_data_in_notify);
+
+					batch_actions.emplace_back(entry.m_disp.get(), afu::dispatcher::ordered_action(entry.m_order_key,
+						std::make_shared<rowdata_batch_async_action>(entry.m_callback, entry.m_batch_callback, batch)));
+					AFU_INSTRUMENT(m_metrics->m_deliveries.fetch_add(1, std::memory_order_relaxed);)
+					continue;
 				}
+
+				if (entry.m_policy == delivery_policy::latest)
+				{
+					if (entry.m_latest_action->update(m_data_in_notify.back()))
+					{
+						entry.m_disp->begin_invoke(entry.m_latest_action, entry.m_order_key);
+						AFU_INSTRUMENT(m_metrics->m_deliveries.fetch_add(1, std::memory_order_relaxed);)
+					}
+					continue;
+				}
+
+				for (const auto& subData : m_data_in_notify)
+				{
+					std::shared_ptr<rowdata_async_action> ac = std::make_shared<rowdata_async_action >(entry.m_callback, subData);
+					entry.m_disp->begin_invoke(ac, entry.m_order_key);
+				}
+				AFU_INSTRUMENT(m_metrics->m_deliveries.fetch_add(m_data_in_notify.size(), std::memory_order_relaxed);)
 			}
 
-			m_need_update = false;
+			m_data_in_notify.clear();
+			dispatch_batches(batch_actions);
+		}
+
+	public:
+
+		subscription_data_pool::statistics get_pool_statistics() const
+		{
+			return m_data_pool.get_statistics();
 		}
 
+		// The newest history_size() samples, oldest first. Shares the pooled buffers, so
+		// they only return to the pool once newer samples pushed them out of the history.
+		std::vector<std::shared_ptr<const subscription_data>> get_history()
+		{
+			std::vector<std::shared_ptr<const subscription_data>> history;
+			std::lock_guard<std::mutex> lock(m_data_notify_mutex);
+			history.reserve(m_history.size());
+			m_history.for_each([&](const std::shared_ptr<subscription_data>& _data)
+				{
+					history.push_back(_data);
+				});
+			return history;
+		}
+
+		static constexpr size_t history_size()
+		{
+			return HISTORY_SIZE;
+		}
+
+		// copy of the newest sample
 		template<typename T>
-		const T& get_last()
+		T get_last()
 		{
-			if (sizeof(T) != m_data_size)
-				throw std::invalid_argument("sizeof(T) != m_data_size");
-			
-			return m_pool_buffer->front().read<T>();
+			T val;
+			if (!try_get_latest(val))
+				throw std::out_of_range("Buffer is empty!");
+
+			return val;
+		}
+
+
+		template<typename T>
+		T get_last_i()
+		{
+			return get_last<T>();
 		}
 
+		// false when nothing was published yet
+		template<typename T>
+		bool try_get_latest(T& _out)
+		{
+			std::uint64_t version = 0;
+			return try_load_latest(_out, version);
+		}
 
+		// false when there is no sample newer than _last_version, otherwise copies it
+		// and updates _last_version
 		template<typename T>
-		const T& get_last_i()
+		bool try_get_latest(T& _out, std::uint64_t& _last_version)
 		{
+			if (m_latest.version() == _last_version)
+				return false;
+
+			std::uint64_t version = 0;
+			if (!try_load_latest(_out, version) || version == _last_version)
+				return false;
+
+			_last_version = version;
+			return true;
+		}
+
+		// number of samples written so far
+		std::uint64_t version() const
+		{
+			return m_latest.version();
+		}
+
+		subscriber_metrics_snapshot get_metrics() const
+		{
+			subscriber_metrics_snapshot snap{};
+			snap.timestamp_ns = instrument_now_ns();
+			snap.published = version();
+			AFU_INSTRUMENT(snap.deliveries = m_metrics->m_deliveries.load(std::memory_order_relaxed);)
+			AFU_INSTRUMENT(snap.callbacks = m_metrics->m_callbacks.load(std::memory_order_relaxed);)
+			AFU_INSTRUMENT(snap.end_to_end = m_metrics->m_end_to_end.snapshot();)
+			return snap;
+		}
+
+	private:
+
+		subscription_id add_subscription(afu::dispatcher* _disp, subscription_entry _entry)
+		{
+			if (_disp == nullptr)
+				throw std::runtime_error("_disp == nullptr");
+
+			_entry.m_disp = std::shared_ptr<afu::dispatcher>(_disp, [](afu::dispatcher*) {});
+			return m_subscriptions.update([&](std::vector<subscription_entry>& _entries)
+				{
+					_entry.m_id = ++m_last_id;
+					_entry.m_order_key = afu::dispatcher::make_order_key(this, _entry.m_id);
+					_entries.push_back(_entry);
+					return _entry.m_id;
+				});
+		}
+
+#if AFU_ENABLE_INSTRUMENTATION
+		subscription_callback instrument_callback(subscription_callback _func) const
+		{
+			auto metrics = m_metrics;
+			return [metrics, _func](const std::shared_ptr<subscription_data>& _data)
+				{
+					_func(_data);
+					metrics->m_callbacks.fetch_add(1, std::memory_order_relaxed);
+					metrics->m_end_to_end.record(instrument_now_ns() - _data->m_publish_ns);
+				};
+		}
+
+		subscription_batch_callback instrument_batch_callback(subscription_batch_callback _func) const
+		{
+			auto metrics = m_metrics;
+			return [metrics, _func](subscription_batch _batch)
+				{
+					_func(_batch);
+					auto now = instrument_now_ns();
+					metrics->m_callbacks.fetch_add(_batch.size(), std::memory_order_relaxed);
+					for (const auto& data : _batch)
+						metrics->m_end_to_end.record(now - data->m_publish_ns);
+				};
+		}
+#endif
+
+		// One add_list_action() per dispatcher, which also wakes it. The stable sort groups
+		// the actions by dispatcher and keeps the subscription order inside each group.
+		static void dispatch_batches(std::vector<std::pair<afu::dispatcher*, afu::dispatcher::ordered_action>>& _batch_actions)
+		{
+			std::stable_sort(_batch_actions.begin(), _batch_actions.end(), [](const auto& _a, const auto& _b)
+				{
+					return std::less<afu::dispatcher*>()(_a.first, _b.first);
+				});
+
+			std::vector<afu::dispatcher::ordered_action> actions;
+			for (size_t i = 0; i < _batch_actions.size(); ++i)
+			{
+				actions.push_back(std::move(_batch_actions[i].second));
+				if (i + 1 == _batch_actions.size() || _batch_actions[i + 1].first != _batch_actions[i].first)
+				{
+					_batch_actions[i].first->add_list_action(actions);
+					actions.clear();
+				}
+			}
+		}
+
+		template<typename T>
+		bool try_load_latest(T& _out, std::uint64_t& _version)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+
 			if (sizeof(T) != m_data_size)
 				throw std::invalid_argument("sizeof(T) != m_data_size");
 
-			return m_pool_buffer->front().read<T>();
+			return m_latest.try_load(&_out, sizeof(T), _version);
 		}
 
 
-
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,293 @@
+#pragma once
+// Schwartz Liran
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include <utils/seqlock.hpp>
+#include <utils/snapshot.hpp>
+#include "delivery_policy.hpp"
+#include "dispatcher.hpp"
+
+
+namespace afu
+{
+
+	// Compile-time typed subscriber.
+	// Samples are stored in a preallocated ring of HISTORY_SIZE slots, so write() does
+	// no heap allocation and no runtime size check. Every subscribed dispatcher owns one
+	// persistent action that is queued at most once and drains all new samples when it runs.
+	// The ring is lossy : a subscription that falls more than HISTORY_SIZE samples behind
+	// skips to the oldest sample still stored, overrun_count() says how many it missed.
+	// Writers are serialized by a mutex, readers copy slots out without a lock.
+	template<typename T, std::size_t HISTORY_SIZE = 16>
+	class typed_subscriber :
+		public std::enable_shared_from_this<typed_subscriber<T, HISTORY_SIZE>>
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+		static_assert(HISTORY_SIZE > 0 && (HISTORY_SIZE & (HISTORY_SIZE - 1)) == 0, "HISTORY_SIZE must be a power of two");
+
+	public:
+
+		using callback_type = std::function<void(const T&)>;
+
+	private:
+
+		static constexpr std::uint64_t HISTORY_MASK = HISTORY_SIZE - 1;
+
+		// Slot storage shared with the pending actions, so a queued action stays valid
+		// even if the subscriber is destroyed before the dispatcher runs it.
+		// Every slot is a seqlock. Slot k holds samples k, k + HISTORY_SIZE, ... so its
+		// store count tells which sample a reader copied.
+		struct slot_ring
+		{
+			std::mutex m_write_lock;  // writers only
+			std::array<afu::seqlock_value<T>, HISTORY_SIZE> m_slots;
+			std::atomic<std::uint64_t> m_head{ 0 }; // total number of samples written
+			std::atomic<std::uint64_t> m_overruns{ 0 };
+			afu::seqlock_value<T> m_latest;
+
+			void push(const T& _val)
+			{
+				std::lock_guard<std::mutex> lock(m_write_lock);
+				auto head = m_head.load(std::memory_order_relaxed);
+				m_slots[head & HISTORY_MASK].store(_val);
+				m_latest.store(_val);
+				m_head.store(head + 1, std::memory_order_release);
+			}
+
+			// Copy the next sample after _cursor. A cursor more than HISTORY_SIZE behind moves
+			// to the oldest sample still stored and counts the skipped ones as overruns,
+			// _latest_only moves it to the newest sample on purpose.
+			bool read_next(std::uint64_t& _cursor, T& _out, bool _latest_only)
+			{
+				while (true)
+				{
+					auto head = m_head.load(std::memory_order_acquire);
+					if (_cursor == head)
+						return false;
+
+					auto target = _cursor;
+					if (_latest_only)
+						target = head - 1;
+					else if (head - target > HISTORY_SIZE)
+						target = head - HISTORY_SIZE;
+
+					std::uint64_t version = 0;
+					if (!m_slots[target & HISTORY_MASK].try_load(_out, version))
+						continue;
+
+					// overwritten since head was read, look again
+					if ((version - 1) * HISTORY_SIZE + (target & HISTORY_MASK) != target)
+						continue;
+
+					if (!_latest_only && target != _cursor)
+						m_overruns.fetch_add(target - _cursor, std::memory_order_relaxed);
+
+					_cursor = target + 1;
+					return true;
+				}
+			}
+
+			std::uint64_t head() const
+			{
+				return m_head.load(std::memory_order_acquire);
+			}
+		};
+
+
+		class typed_async_action :
+			public afu::async_action_context
+		{
+			std::shared_ptr<slot_ring> m_ring;
+			afu::dispatcher* m_disp;
+			callback_type m_callback;
+			std::uint64_t m_cursor;
+			std::atomic_bool m_pending;
+			bool m_latest_only;
+
+		public:
+
+			typed_async_action(const std::shared_ptr<slot_ring>& _ring, afu::dispatcher* _disp, callback_type _callback, bool _latest_only) :
+				m_ring(_ring),
+				m_disp(_disp),
+				m_callback(std::move(_callback)),
+				m_cursor(_ring->head()),
+				m_pending(false),
+				m_latest_only(_latest_only)
+			{}
+
+			// true when the action has to be queued on the dispatcher
+			bool mark_pending()
+			{
+				return m_pending.exchange(true) == false;
+			}
+
+			afu::dispatcher* get_dispatcher() const
+			{
+				return m_disp;
+			}
+
+			// dropped by a bounded dispatcher : the next write() queues us again, the
+			// cursor did not move so nothing still in the ring is lost
+			virtual void on_dropped() override
+			{
+				m_pending.store(false);
+			}
+
+			virtual void run_action() override
+			{
+				// clear first, a write that races with the drain below queues us again
+				m_pending.store(false);
+
+				T val;
+				while (m_ring->read_next(m_cursor, val, m_latest_only))
+				{
+					try
+					{
+						m_callback(val);
+					}
+					catch (const std::exception&)
+					{
+						throw std::runtime_error("callback exception\n");
+					}
+				}
+			}
+		};
+
+		std::shared_ptr<slot_ring> m_ring;
+
+		struct subscription_entry
+		{
+			subscription_id m_id;
+			std::shared_ptr<typed_async_action> m_action;
+			size_t m_order_key;  // a dispatcher_pool must never run the action twice at once
+		};
+
+		// copy-on-write, write() walks a snapshot without taking a lock
+		afu::snapshot_ptr<std::vector<subscription_entry>> m_subscriptions;
+		subscription_id m_last_id = 0;
+
+	public:
+
+		typed_subscriber() :
+			m_ring(std::make_shared<slot_ring>())
+		{}
+
+		typed_subscriber(const typed_subscriber& other) = delete;
+
+
+		// each : a queued action drains every new sample still in the ring, one callback per
+		// sample. latest : only the newest one. batched has no typed callback and is refused.
+		virtual subscription_id subscribe(afu::dispatcher* _disp, callback_type _func, delivery_policy _policy = delivery_policy::each)
+		{
+			if (_disp == nullptr)
+				throw std::runtime_error("_disp == nullptr");
+
+			if (_func == nullptr)
+				throw std::runtime_error("_func == nullptr");
+
+			if (_policy != delivery_policy::each && _policy != delivery_policy::latest)
+				throw std::invalid_argument("typed_subscriber supports delivery_policy::each and latest only");
+
+			auto ac = std::make_shared<typed_async_action>(m_ring, _disp, std::move(_func), _policy == delivery_policy::latest);
+			return m_subscriptions.update([&](std::vector<subscription_entry>& _entries)
+				{
+					_entries.push_back({ ++m_last_id, ac, afu::dispatcher::make_order_key(ac.get()) });
+					return m_last_id;
+				});
+		}
+
+		// An action already queued on the dispatcher still runs once
+		virtual bool unsubscribe(subscription_id _id)
+		{
+			return m_subscriptions.update([&](std::vector<subscription_entry>& _entries)
+				{
+					for (auto it = _entries.begin(); it != _entries.end(); ++it)
+					{
+						if (it->m_id == _id)
+						{
+							_entries.erase(it);
+							return true;
+						}
+					}
+					return false;
+				});
+		}
+
+		size_t subscription_count() const
+		{
+			return m_subscriptions.load()->size();
+		}
+
+		void write(const T& _val)
+		{
+			m_ring->push(_val);
+
+			auto subscriptions = m_subscriptions.load();
+			for (const auto& entry : *subscriptions)
+			{
+				if (entry.m_action->mark_pending())
+					entry.m_action->get_dispatcher()->begin_invoke(entry.m_action, entry.m_order_key);
+			}
+		}
+
+		// copy of the newest sample, lock-free
+		T get_last()
+		{
+			T val;
+			if (!try_get_latest(val))
+				throw std::out_of_range("Buffer is empty!");
+
+			return val;
+		}
+
+		// false when nothing was published yet
+		bool try_get_latest(T& _out) const
+		{
+			std::uint64_t version = 0;
+			return m_ring->m_latest.try_load(_out, version);
+		}
+
+		// false when there is no sample newer than _last_version, otherwise copies it
+		// and updates _last_version
+		bool try_get_latest(T& _out, std::uint64_t& _last_version) const
+		{
+			if (m_ring->m_latest.version() == _last_version)
+				return false;
+
+			std::uint64_t version = 0;
+			if (!m_ring->m_latest.try_load(_out, version) || version == _last_version)
+				return false;
+
+			_last_version = version;
+			return true;
+		}
+
+		// number of samples written so far
+		std::uint64_t version() const
+		{
+			return m_ring->m_latest.version();
+		}
+
+		// samples that delivery_policy::each subscriptions missed because they fell more than
+		// HISTORY_SIZE behind, summed over all subscriptions
+		std::uint64_t overrun_count() const
+		{
+			return m_ring->m_overruns.load(std::memory_order_relaxed);
+		}
+
+		static constexpr std::size_t history_size()
+		{
+			return HISTORY_SIZE;
+		}
+
+	};
+
+}
@@ -0,0 +1,358 @@
+#pragma once
+// Schwartz Liran
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <utils/task.hpp>
+#include <utils/thread_utils.hpp>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define AFU_HAS_COROUTINES 1
+#else
+#define AFU_HAS_COROUTINES 0
+#endif
+
+// Async result : single shot future / promise pair for dispatcher work.
+// Completion is one atomic exchange, there is no mutex or condition variable; a
+// continuation registered with then() (or a co_await) runs on the completing thread.
+// Under C++20 async_result is awaitable and can be the return type of a coroutine.
+namespace afu
+{
+
+	namespace detail
+	{
+		template<typename T>
+		struct result_value
+		{
+			std::optional<T> m_value;
+
+			template<typename U>
+			void set_value(U&& _value)
+			{
+				m_value.emplace(std::forward<U>(_value));
+			}
+
+			T take_value()
+			{
+				return std::move(*m_value);
+			}
+		};
+
+		template<>
+		struct result_value<void>
+		{
+			void set_value()
+			{}
+
+			void take_value()
+			{}
+		};
+	}
+
+
+	template<typename T>
+	class async_state :
+		public detail::result_value<T>
+	{
+	private:
+
+		static constexpr int PENDING = 0;
+		static constexpr int CONTINUATION = 1;
+		static constexpr int READY = 2;
+
+		std::atomic<int> m_phase{ PENDING };
+		task m_continuation;
+
+	public:
+
+		std::exception_ptr m_error;
+
+		// value or error already stored
+		void complete()
+		{
+			if (m_phase.exchange(READY, std::memory_order_acq_rel) == CONTINUATION)
+			{
+				auto continuation = std::move(m_continuation);
+				continuation();
+			}
+#if defined(__cpp_lib_atomic_wait)
+			m_phase.notify_all();
+#endif
+		}
+
+		bool ready() const noexcept
+		{
+			return m_phase.load(std::memory_order_acquire) == READY;
+		}
+
+		// false when the result is ready already, _continuation is then handed back untouched
+		bool set_continuation(task& _continuation)
+		{
+			m_continuation = std::move(_continuation);
+			int expected = PENDING;
+			if (m_phase.compare_exchange_strong(expected, CONTINUATION, std::memory_order_acq_rel))
+				return true;
+
+			_continuation = std::move(m_continuation);
+			return false;
+		}
+
+		void wait() const
+		{
+			if (ready())
+				return;
+
+#if defined(__cpp_lib_atomic_wait)
+			auto phase = m_phase.load(std::memory_order_acquire);
+			while (phase != READY)
+			{
+				m_phase.wait(phase, std::memory_order_acquire);
+				phase = m_phase.load(std::memory_order_acquire);
+			}
+#else
+			// short results are caught spinning or yielding, long ones back off to sleeping
+			if (spin_until(std::chrono::microseconds(2), [&]() { return ready(); }))
+				return;
+
+			for (int i = 0; i < 256 && !ready(); ++i)
+				std::this_thread::yield();
+
+			auto pause = std::chrono::microseconds(10);
+			while (!ready())
+			{
+				std::this_thread::sleep_for(pause);
+				if (pause < std::chrono::milliseconds(1))
+					pause *= 2;
+			}
+#endif
+		}
+	};
+
+
+	template<typename T>
+	class async_result;
+
+
+	// Producer side. Destroying it without a value (the action was dropped or the
+	// dispatcher stopped first) completes the result with an exception.
+	template<typename T>
+	class async_promise
+	{
+	private:
+
+		std::shared_ptr<async_state<T>> m_state;
+
+	public:
+
+		async_promise() :
+			m_state(std::make_shared<async_state<T>>())
+		{}
+
+		async_promise(async_promise&& other) noexcept = default;
+
+		async_promise(const async_promise& other) = delete;
+		async_promise& operator=(async_promise&& other) = delete;
+		async_promise& operator=(const async_promise& other) = delete;
+
+		~async_promise()
+		{
+			if (m_state != nullptr)
+				set_exception(std::make_exception_ptr(std::runtime_error("async_promise destroyed without a result")));
+		}
+
+		async_result<T> get_result() const
+		{
+			return async_result<T>(m_state);
+		}
+
+		template<typename... U>
+		void set_value(U&&... _value)
+		{
+			auto state = std::move(m_state);
+			state->set_value(std::forward<U>(_value)...);
+			state->complete();
+		}
+
+		void set_exception(std::exception_ptr _error)
+		{
+			auto state = std::move(m_state);
+			state->m_error = std::move(_error);
+			state->complete();
+		}
+
+		// Completes with the return value of _func() or with what it threw
+		template<typename F>
+		void run(F& _func)
+		{
+			try
+			{
+				if constexpr (std::is_void<T>::value)
+				{
+					_func();
+					set_value();
+				}
+				else
+				{
+					set_value(_func());
+				}
+			}
+			catch (...)
+			{
+				set_exception(std::current_exception());
+			}
+		}
+	};
+
+
+#if AFU_HAS_COROUTINES
+	namespace detail
+	{
+		template<typename T>
+		struct async_promise_base
+		{
+			std::shared_ptr<async_state<T>> m_state = std::make_shared<async_state<T>>();
+
+			template<typename U>
+			void return_value(U&& _value)
+			{
+				m_state->set_value(std::forward<U>(_value));
+				m_state->complete();
+			}
+		};
+
+		template<>
+		struct async_promise_base<void>
+		{
+			std::shared_ptr<async_state<void>> m_state = std::make_shared<async_state<void>>();
+
+			void return_void()
+			{
+				m_state->complete();
+			}
+		};
+
+		// Coroutine returning async_result<T> : starts eagerly, the result completes at co_return
+		template<typename T>
+		struct async_coroutine_promise :
+			public async_promise_base<T>
+		{
+			async_result<T> get_return_object()
+			{
+				return async_result<T>(this->m_state);
+			}
+
+			std::suspend_never initial_suspend() noexcept
+			{
+				return {};
+			}
+
+			std::suspend_never final_suspend() noexcept
+			{
+				return {};
+			}
+
+			void unhandled_exception()
+			{
+				this->m_state->m_error = std::current_exception();
+				this->m_state->complete();
+			}
+		};
+	}
+#endif
+
+
+	// Consumer side, get() may be called once
+	template<typename T>
+	class async_result
+	{
+	private:
+
+		std::shared_ptr<async_state<T>> m_state;
+
+	public:
+
+#if AFU_HAS_COROUTINES
+		using promise_type = detail::async_coroutine_promise<T>;
+#endif
+
+		async_result() = default;
+
+		explicit async_result(std::shared_ptr<async_state<T>> _state) :
+			m_state(std::move(_state))
+		{}
+
+		bool valid() const noexcept
+		{
+			return m_state != nullptr;
+		}
+
+		bool ready() const noexcept
+		{
+			return m_state != nullptr && m_state->ready();
+		}
+
+		void wait() const
+		{
+			m_state->wait();
+		}
+
+		// Blocks until the result is ready, rethrows what the action threw
+		T get()
+		{
+			if (m_state == nullptr)
+				throw std::logic_error("async_result has no state");
+
+			auto state = std::move(m_state);
+			state->wait();
+			if (state->m_error)
+				std::rethrow_exception(state->m_error);
+
+			return state->take_value();
+		}
+
+		// _func(async_result<T>) runs once the result is ready: on the completing thread,
+		// or right here when it is ready already. Post from it to move to another dispatcher.
+		template<typename F>
+		void then(F&& _func)
+		{
+			auto state = std::move(m_state);
+			task continuation([func = std::forward<F>(_func), state]() mutable
+				{
+					func(async_result<T>(state));
+				});
+
+			if (!state->set_continuation(continuation))
+				continuation();
+		}
+
+#if AFU_HAS_COROUTINES
+		bool await_ready() const noexcept
+		{
+			return ready();
+		}
+
+		bool await_suspend(std::coroutine_handle<> _handle)
+		{
+			task continuation([_handle]()
+				{
+					_handle.resume();
+				});
+			return m_state->set_continuation(continuation);
+		}
+
+		T await_resume()
+		{
+			return get();
+		}
+#endif
+	};
+
+}
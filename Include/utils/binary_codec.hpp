@@ -0,0 +1,389 @@
+#pragma once
+// Schwartz Liran
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utils/span.hpp>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define AFU_CODEC_SSE2 1
+#else
+#define AFU_CODEC_SSE2 0
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <stdlib.h>
+#endif
+
+// Binary codec : portable wire format for trivially copyable structs.
+// Fields are written back to back (no padding) in wire byte order, little endian unless
+// asked otherwise, so on the usual hosts packing is a copy and a big endian node pays the
+// swap. Arrays of 16/32/64 bit values are swapped 32 (AVX2, when the build enables it) or
+// 16 (SSE2) bytes at a time.
+//
+//	struct sample { std::uint32_t id; double values[4]; std::int16_t flags; };
+//	using sample_layout = afu::struct_layout<sample,
+//		afu::field<&sample::id>, afu::field<&sample::values>, afu::field<&sample::flags>>;
+//	sample_layout::pack(value, buffer);  // sample_layout::wire_size bytes
+namespace afu
+{
+
+	enum class endian
+	{
+		little,
+		big,
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+		native = little
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		native = big
+#else
+#error "binary_codec : unknown host byte order"
+#endif
+	};
+
+	constexpr endian wire_endian = endian::little;
+
+
+	// Row-major matrix over contiguous storage, one block instead of a vector per row
+	template<typename T>
+	class matrix_view
+	{
+	private:
+
+		T* m_data;
+		size_t m_rows;
+		size_t m_cols;
+
+	public:
+
+		matrix_view() noexcept :
+			m_data(nullptr),
+			m_rows(0),
+			m_cols(0)
+		{}
+
+		matrix_view(T* _data, size_t _rows, size_t _cols) noexcept :
+			m_data(_data),
+			m_rows(_rows),
+			m_cols(_cols)
+		{}
+
+		template<size_t ROWS, size_t COLS>
+		matrix_view(T(&_array)[ROWS][COLS]) noexcept :
+			m_data(&_array[0][0]),
+			m_rows(ROWS),
+			m_cols(COLS)
+		{}
+
+		T* data() const noexcept { return m_data; }
+
+		size_t rows() const noexcept { return m_rows; }
+
+		size_t cols() const noexcept { return m_cols; }
+
+		size_t size() const noexcept { return m_rows * m_cols; }
+
+		bool empty() const noexcept { return size() == 0; }
+
+		T& operator()(size_t _row, size_t _col) const noexcept { return m_data[_row * m_cols + _col]; }
+
+		span<T> row(size_t _row) const noexcept { return span<T>(m_data + _row * m_cols, m_cols); }
+
+		// every element, row after row
+		span<T> elements() const noexcept { return span<T>(m_data, size()); }
+	};
+
+
+	namespace detail
+	{
+		template<typename T>
+		struct is_wire_scalar :
+			std::integral_constant<bool, (std::is_arithmetic<T>::value || std::is_enum<T>::value) &&
+				(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8)>
+		{};
+
+		inline std::uint16_t swap16(std::uint16_t _value) noexcept
+		{
+#if defined(_MSC_VER) && !defined(__clang__)
+			return _byteswap_ushort(_value);
+#else
+			return __builtin_bswap16(_value);
+#endif
+		}
+
+		inline std::uint32_t swap32(std::uint32_t _value) noexcept
+		{
+#if defined(_MSC_VER) && !defined(__clang__)
+			return _byteswap_ulong(_value);
+#else
+			return __builtin_bswap32(_value);
+#endif
+		}
+
+		inline std::uint64_t swap64(std::uint64_t _value) noexcept
+		{
+#if defined(_MSC_VER) && !defined(__clang__)
+			return _byteswap_uint64(_value);
+#else
+			return __builtin_bswap64(_value);
+#endif
+		}
+
+		template<size_t WIDTH>
+		inline void swap_one(const unsigned char* _src, unsigned char* _dst) noexcept
+		{
+			if constexpr (WIDTH == 2)
+			{
+				std::uint16_t value;
+				std::memcpy(&value, _src, 2);
+				value = swap16(value);
+				std::memcpy(_dst, &value, 2);
+			}
+			else if constexpr (WIDTH == 4)
+			{
+				std::uint32_t value;
+				std::memcpy(&value, _src, 4);
+				value = swap32(value);
+				std::memcpy(_dst, &value, 4);
+			}
+			else
+			{
+				std::uint64_t value;
+				std::memcpy(&value, _src, 8);
+				value = swap64(value);
+				std::memcpy(_dst, &value, 8);
+			}
+		}
+
+#if AFU_CODEC_SSE2
+		// SSE2 has no byte shuffle : swap the bytes of every 16 bit lane, then reverse the lanes
+		template<size_t WIDTH>
+		inline __m128i swap_sse2(__m128i _chunk) noexcept
+		{
+			_chunk = _mm_or_si128(_mm_slli_epi16(_chunk, 8), _mm_srli_epi16(_chunk, 8));
+			if constexpr (WIDTH == 4)
+			{
+				_chunk = _mm_shufflelo_epi16(_chunk, _MM_SHUFFLE(2, 3, 0, 1));
+				_chunk = _mm_shufflehi_epi16(_chunk, _MM_SHUFFLE(2, 3, 0, 1));
+			}
+			else if constexpr (WIDTH == 8)
+			{
+				_chunk = _mm_shufflelo_epi16(_chunk, _MM_SHUFFLE(0, 1, 2, 3));
+				_chunk = _mm_shufflehi_epi16(_chunk, _MM_SHUFFLE(0, 1, 2, 3));
+			}
+			return _chunk;
+		}
+#endif
+
+		// Reverses every WIDTH byte element of _src into _dst, _src == _dst is allowed
+		template<size_t WIDTH>
+		inline void swap_bytes(const unsigned char* _src, unsigned char* _dst, size_t _count) noexcept
+		{
+			static_assert(WIDTH == 2 || WIDTH == 4 || WIDTH == 8, "byte swap width must be 2, 4 or 8");
+
+			size_t bytes = _count * WIDTH;
+			size_t offset = 0;
+#if defined(__AVX2__)
+			if (bytes >= 32)
+			{
+				// shuffle_epi8 works per 128 bit lane, both lanes use the same pattern
+				alignas(32) char pattern[32];
+				for (size_t i = 0; i < 32; ++i)
+					pattern[i] = static_cast<char>((i % 16) / WIDTH * WIDTH + (WIDTH - 1 - i % WIDTH));
+
+				auto shuffle = _mm256_load_si256(reinterpret_cast<const __m256i*>(pattern));
+				for (; bytes - offset >= 32; offset += 32)
+				{
+					auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(_src + offset));
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(_dst + offset), _mm256_shuffle_epi8(chunk, shuffle));
+				}
+			}
+#endif
+#if AFU_CODEC_SSE2
+			for (; bytes - offset >= 16; offset += 16)
+			{
+				auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_src + offset));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(_dst + offset), swap_sse2<WIDTH>(chunk));
+			}
+#endif
+			for (; offset < bytes; offset += WIDTH)
+				swap_one<WIDTH>(_src + offset, _dst + offset);
+		}
+
+		// _count elements of T from _src to _dst, swapped when the two orders differ
+		template<typename T>
+		inline void copy_ordered(const void* _src, void* _dst, size_t _count, bool _swap) noexcept
+		{
+			auto src = static_cast<const unsigned char*>(_src);
+			auto dst = static_cast<unsigned char*>(_dst);
+			if constexpr (sizeof(T) > 1)
+			{
+				if (_swap)
+				{
+					swap_bytes<sizeof(T)>(src, dst, _count);
+					return;
+				}
+			}
+
+			if (src != dst)
+				std::memcpy(dst, src, _count * sizeof(T));
+		}
+	}
+
+
+	// One value with its bytes reversed
+	template<typename T>
+	T byte_swap(T _value) noexcept
+	{
+		static_assert(detail::is_wire_scalar<T>::value, "byte_swap needs an 8, 16, 32 or 64 bit number or enum");
+
+		detail::copy_ordered<T>(&_value, &_value, 1, true);
+		return _value;
+	}
+
+	// Reverses the bytes of every element in place
+	template<typename T>
+	void byte_swap_n(T* _data, size_t _count) noexcept
+	{
+		static_assert(detail::is_wire_scalar<T>::value, "byte_swap_n needs 8, 16, 32 or 64 bit numbers or enums");
+
+		detail::copy_ordered<T>(_data, _data, _count, true);
+	}
+
+	// Writes _count values to _dst in ORDER, _count * sizeof(T) bytes
+	template<endian ORDER = wire_endian, typename T>
+	unsigned char* store_n(const T* _src, size_t _count, unsigned char* _dst) noexcept
+	{
+		static_assert(detail::is_wire_scalar<T>::value, "store_n needs 8, 16, 32 or 64 bit numbers or enums");
+
+		detail::copy_ordered<T>(_src, _dst, _count, ORDER != endian::native);
+		return _dst + _count * sizeof(T);
+	}
+
+	// Reads _count values written by store_n() with the same ORDER
+	template<endian ORDER = wire_endian, typename T>
+	const unsigned char* load_n(const unsigned char* _src, size_t _count, T* _dst) noexcept
+	{
+		static_assert(detail::is_wire_scalar<T>::value, "load_n needs 8, 16, 32 or 64 bit numbers or enums");
+
+		detail::copy_ordered<T>(_src, _dst, _count, ORDER != endian::native);
+		return _src + _count * sizeof(T);
+	}
+
+
+	namespace detail
+	{
+		// Member types a field can have : a number / enum, a (multi dimensional) C array or
+		// a std::array of them. All of them keep their elements contiguous.
+		template<typename M>
+		struct wire_member
+		{
+			using element_type = std::remove_all_extents_t<M>;
+			static constexpr size_t count = sizeof(M) / sizeof(element_type);
+
+			static const element_type* data(const M& _member) noexcept
+			{
+				return reinterpret_cast<const element_type*>(&_member);
+			}
+
+			static element_type* data(M& _member) noexcept
+			{
+				return reinterpret_cast<element_type*>(&_member);
+			}
+		};
+
+		template<typename E, size_t N>
+		struct wire_member<std::array<E, N>>
+		{
+			using element_type = E;
+			static constexpr size_t count = N;
+
+			static const E* data(const std::array<E, N>& _member) noexcept { return _member.data(); }
+
+			static E* data(std::array<E, N>& _member) noexcept { return _member.data(); }
+		};
+	}
+
+
+	// One member of a struct_layout, given by its member pointer
+	template<auto MEMBER>
+	struct field;
+
+	template<typename S, typename M, M S::* MEMBER>
+	struct field<MEMBER>
+	{
+		using struct_type = S;
+		using member_type = M;
+		using traits = detail::wire_member<M>;
+
+		static_assert(detail::is_wire_scalar<typename traits::element_type>::value,
+			"field must be a number, an enum or an array of them");
+
+		static constexpr size_t wire_size = traits::count * sizeof(typename traits::element_type);
+
+		template<endian ORDER>
+		static unsigned char* pack(const S& _value, unsigned char* _out) noexcept
+		{
+			return store_n<ORDER>(traits::data(_value.*MEMBER), traits::count, _out);
+		}
+
+		template<endian ORDER>
+		static const unsigned char* unpack(const unsigned char* _in, S& _value) noexcept
+		{
+			return load_n<ORDER>(_in, traits::count, traits::data(_value.*MEMBER));
+		}
+	};
+
+
+	// Compile time description of how S goes on the wire : the listed fields, in that order,
+	// without padding. Members left out are not written and keep their value on unpack().
+	template<typename S, typename... Fields>
+	struct struct_layout
+	{
+		static_assert(sizeof...(Fields) > 0, "struct_layout needs at least one field");
+		static_assert((std::is_base_of<typename Fields::struct_type, S>::value && ...), "field belongs to another struct");
+
+		using struct_type = S;
+
+		static constexpr size_t wire_size = (Fields::wire_size + ...);
+
+		// Writes wire_size bytes to _out and returns the end of them
+		template<endian ORDER = wire_endian>
+		static unsigned char* pack(const S& _value, unsigned char* _out) noexcept
+		{
+			((_out = Fields::template pack<ORDER>(_value, _out)), ...);
+			return _out;
+		}
+
+		template<endian ORDER = wire_endian>
+		static const unsigned char* unpack(const unsigned char* _in, S& _value) noexcept
+		{
+			((_in = Fields::template unpack<ORDER>(_in, _value)), ...);
+			return _in;
+		}
+
+		// _count structs back to back, _count * wire_size bytes
+		template<endian ORDER = wire_endian>
+		static unsigned char* pack_n(const S* _values, size_t _count, unsigned char* _out) noexcept
+		{
+			for (size_t i = 0; i < _count; ++i)
+				_out = pack<ORDER>(_values[i], _out);
+
+			return _out;
+		}
+
+		template<endian ORDER = wire_endian>
+		static const unsigned char* unpack_n(const unsigned char* _in, size_t _count, S* _values) noexcept
+		{
+			for (size_t i = 0; i < _count; ++i)
+				_in = unpack<ORDER>(_in, _values[i]);
+
+			return _in;
+		}
+	};
+
+}
@@ -1,10 +1,16 @@
 #pragma once
 #include <iostream>
+#include <atomic>
 #include <queue>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <stdexcept>
 #include <string>
 #include <vector>
+#include <utils/mpsc_queue.hpp>
+#include <utils/span.hpp>
 
 namespace afu
 {
@@ -102,6 +108,229 @@ namespace afu
 
 	};
 
+	// What a full spsc_ring does with a new element
+	enum class ring_mode
+	{
+		reject,    // the push fails
+		overwrite  // the oldest element is dropped, keeps the newest capacity() elements
+	};
+
+	// Bounded lock-free single-producer / single-consumer ring.
+	// Capacity is rounded up to a power of two so indexes wrap with a mask. Both sides
+	// keep a cached copy of the other index and only reload it when the ring looks
+	// full / empty, so a steady stream costs one atomic store per push or pop batch.
+	// Elements are constructed in place on push and destroyed on pop.
+	// ring_mode::overwrite moves the read index from the producer side, so it is only
+	// for a ring whose pushes and pops are serialized (a history under a lock).
+	template <typename T>
+	class spsc_ring
+	{
+	private:
+
+		struct slot
+		{
+			alignas(T) unsigned char m_bytes[sizeof(T)];
+		};
+
+		std::unique_ptr<slot[]> m_slots;
+		size_t m_mask;
+		ring_mode m_mode;
+
+		// consumer side
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_head{ 0 };
+		size_t m_cached_tail = 0;
+
+		// producer side
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_tail{ 0 };
+		size_t m_cached_head = 0;
+
+		static size_t round_up(size_t _capacity)
+		{
+			size_t capacity = 2;
+			while (capacity < _capacity)
+				capacity <<= 1;
+
+			return capacity;
+		}
+
+		T* at(size_t _index) const noexcept
+		{
+			return std::launder(reinterpret_cast<T*>(m_slots[_index & m_mask].m_bytes));
+		}
+
+		// false when full in reject mode, drops the oldest in overwrite mode
+		bool make_room(size_t _tail)
+		{
+			if (_tail - m_cached_head <= m_mask)
+				return true;
+
+			m_cached_head = m_head.load(std::memory_order_acquire);
+			if (_tail - m_cached_head <= m_mask)
+				return true;
+
+			if (m_mode == ring_mode::reject)
+				return false;
+
+			// serialized with the consumer here, keep its cached tail from falling behind the head
+			at(m_cached_head)->~T();
+			m_head.store(++m_cached_head, std::memory_order_release);
+			if (m_cached_tail < m_cached_head)
+				m_cached_tail = m_cached_head;
+
+			return true;
+		}
+
+	public:
+
+		explicit spsc_ring(size_t _capacity, ring_mode _mode = ring_mode::reject) :
+			m_slots(new slot[round_up(_capacity)]),
+			m_mask(round_up(_capacity) - 1),
+			m_mode(_mode)
+		{}
+
+		spsc_ring(const spsc_ring& other) = delete;
+
+		~spsc_ring()
+		{
+			auto tail = m_tail.load(std::memory_order_acquire);
+			for (auto head = m_head.load(std::memory_order_acquire); head != tail; ++head)
+				at(head)->~T();
+		}
+
+		size_t capacity() const noexcept
+		{
+			return m_mask + 1;
+		}
+
+		ring_mode mode() const noexcept
+		{
+			return m_mode;
+		}
+
+		// producer only
+		template<typename... Args>
+		bool try_emplace(Args&&... _args)
+		{
+			auto tail = m_tail.load(std::memory_order_relaxed);
+			if (!make_room(tail))
+				return false;
+
+			new (m_slots[tail & m_mask].m_bytes) T(std::forward<Args>(_args)...);
+			m_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// producer only, _value is left untouched when the push fails
+		template<typename U>
+		bool try_push(U&& _value)
+		{
+			return try_emplace(std::forward<U>(_value));
+		}
+
+		// producer only, constructs from *_first ... (wrap with std::make_move_iterator
+		// to move) and publishes them with a single index update. Returns how many went in.
+		template<typename It>
+		size_t push_n(It _first, size_t _count)
+		{
+			auto tail = m_tail.load(std::memory_order_relaxed);
+			if (m_mode == ring_mode::reject)
+			{
+				if (capacity() - (tail - m_cached_head) < _count)
+					m_cached_head = m_head.load(std::memory_order_acquire);
+
+				auto room = capacity() - (tail - m_cached_head);
+				if (_count > room)
+					_count = room;
+			}
+
+			for (size_t i = 0; i < _count; ++i, ++_first)
+			{
+				make_room(tail + i);
+				new (m_slots[(tail + i) & m_mask].m_bytes) T(*_first);
+			}
+
+			if (_count > 0)
+				m_tail.store(tail + _count, std::memory_order_release);
+
+			return _count;
+		}
+
+		// consumer only
+		bool try_pop(T& _out)
+		{
+			return pop_n(&_out, 1) == 1;
+		}
+
+		// consumer only, moves up to _max elements out with a single index update
+		size_t pop_n(T* _out, size_t _max)
+		{
+			auto head = m_head.load(std::memory_order_relaxed);
+			if (m_cached_tail - head < _max)
+				m_cached_tail = m_tail.load(std::memory_order_acquire);
+
+			auto count = m_cached_tail - head;
+			if (count > _max)
+				count = _max;
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				auto* item = at(head + i);
+				_out[i] = std::move(*item);
+				item->~T();
+			}
+
+			if (count > 0)
+				m_head.store(head + count, std::memory_order_release);
+
+			return count;
+		}
+
+		// consumer only, the readable elements that are contiguous in memory (up to the
+		// wrap point). Process them in place, then release them with consume().
+		span<T> peek()
+		{
+			auto head = m_head.load(std::memory_order_relaxed);
+			m_cached_tail = m_tail.load(std::memory_order_acquire);
+
+			auto count = m_cached_tail - head;
+			auto to_end = capacity() - (head & m_mask);
+			return span<T>(at(head), count < to_end ? count : to_end);
+		}
+
+		// consumer only, drops the first _count elements returned by peek()
+		void consume(size_t _count)
+		{
+			auto head = m_head.load(std::memory_order_relaxed);
+			for (size_t i = 0; i < _count; ++i)
+				at(head + i)->~T();
+
+			m_head.store(head + _count, std::memory_order_release);
+		}
+
+		// consumer only, calls _func on every readable element, oldest first, without
+		// removing them. Wraps around where peek() stops.
+		template<typename F>
+		void for_each(F&& _func) const
+		{
+			auto head = m_head.load(std::memory_order_relaxed);
+			auto tail = m_tail.load(std::memory_order_acquire);
+			for (; head != tail; ++head)
+				_func(static_cast<const T&>(*at(head)));
+		}
+
+		// approximate when called while the other side is working
+		size_t size() const noexcept
+		{
+			return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+		}
+
+		bool empty() const noexcept
+		{
+			return size() == 0;
+		}
+	};
+
+
 	template <typename T>
 	class threadSafeQueue
 	{
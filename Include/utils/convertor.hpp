@@ -1,7 +1,11 @@
 #pragma once
 
 #include <iostream>
+#include <string>
+#include <string_view>
 #include <vector>
+#include <utils/binary_codec.hpp>
+#include <utils/tokenizer.hpp>
 
 
 // Schwartz Liran 
@@ -22,19 +26,28 @@ namespace afu
 			}
 			return vec;
 		}
+
+		// Row-major view over the array itself, no copy and no allocation per row
+		template <typename T, std::size_t ROWS, std::size_t COLS>
+		static matrix_view<T> arrayToView(T(&array)[ROWS][COLS])
+		{
+			return matrix_view<T>(array);
+		}
 		
 		
 		namespace string
 		{
-			static std::vector<std::string> split(const std::string& str, char delimiter)
+			// Same fields as std::getline in a loop : a trailing delimiter adds no empty token.
+			// Allocates the result, use afu::tokenizer directly to parse without allocating.
+			static std::vector<std::string> split(std::string_view str, char delimiter)
 			{
 				std::vector<std::string> tokens;
-				std::istringstream stream(str);
-				std::string token;
+				for (auto token : tokenizer(str, delimiter))
+					tokens.emplace_back(token);
+
+				if (!tokens.empty() && tokens.back().empty())
+					tokens.pop_back();
 
-				while (std::getline(stream, token, delimiter)) {
-					tokens.push_back(token);
-				}
 				return tokens;
 			}
 		}
@@ -6,6 +6,9 @@
 #include <functional>
 #include <mutex>
 #include <subscription/subscription.hpp>
+#include <subscription/broker.hpp>
+#include <subscription/dispatcher_pool.hpp>
+#include <subscription/typed_subscriber.hpp>
 
 
 namespace afu
@@ -15,13 +18,32 @@ namespace afu
 
 	public:
 
-		bool subscribe(const std::shared_ptr<subscriber>& _sub, std::function<void(const std::shared_ptr<subscription_data>&) > _callback)
+		// The subscribe helpers return the id for unsubscribe(), 0 for a null subscriber or callback
+		subscription_id subscribe(const std::shared_ptr<subscriber>& _sub, std::function<void(const std::shared_ptr<subscription_data>&) > _callback,
+			delivery_policy _policy = delivery_policy::each)
 		{
 			if (_sub == nullptr || _callback == nullptr)
-				return false;
+				return 0;
 
-			_sub->subscribe(this, _callback);
-			return true;
+			return _sub->subscribe(this, _callback, _policy);
+		}
+
+		subscription_id subscribe_batch(const std::shared_ptr<subscriber>& _sub, subscription_batch_callback _callback)
+		{
+			if (_sub == nullptr || _callback == nullptr)
+				return 0;
+
+			return _sub->subscribe_batch(this, _callback);
+		}
+
+		template<typename T, std::size_t HISTORY_SIZE>
+		subscription_id subscribe(const std::shared_ptr<typed_subscriber<T, HISTORY_SIZE>>& _sub, typename typed_subscriber<T, HISTORY_SIZE>::callback_type _callback,
+			delivery_policy _policy = delivery_policy::each)
+		{
+			if (_sub == nullptr || _callback == nullptr)
+				return 0;
+
+			return _sub->subscribe(this, _callback, _policy);
 		}
 	};
 }
@@ -1,46 +1,96 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 #include <functional>
-#include <mutex>
+#include <utils/async_result.hpp>
+#include <utils/snapshot.hpp>
 
-// Schwartz Liran 
-// Convertors : util hpp file to convert between any obj
+// Schwartz Liran
+// Smart event : multicast callback list. The handler list is a copy-on-write snapshot,
+// invoke() walks it without a lock and hands every handler the same const references,
+// so handlers may run for long, add or remove handlers, or invoke the event again.
+// invoke_async() / invoke_parallel() run each handler as its own action on a dispatcher
+// (anything with bool post(F)); on a dispatcher_pool independent handlers run in parallel.
 namespace afu
 {
 
+	// Returned by smart_event::operator+=, 0 is never a valid token
+	using event_token = std::uint64_t;
+
 	template<typename... Args>
 	class smart_event
 	{
 	public:
-		using GenericCallBack =  std::function<void(Args...)>;
+		using GenericCallBack =  std::function<void(const Args&...)>;
+
+		smart_event() = default;
+
+		smart_event(const smart_event& other) = delete;
 
-		void operator+=(GenericCallBack _func)
+		// A handler added during invoke() is called from the next invoke() on
+		event_token operator+=(GenericCallBack _func)
 		{
-			std::lock_guard<std::mutex> lock(m_lock);
-			m_func.push_back(std::make_shared<GenericCallBack>(_func));
+			auto handler = std::make_shared<const GenericCallBack>(std::move(_func));
+			return m_handlers.update([&](handler_list& _handlers)
+				{
+					auto token = ++m_last_token;
+					_handlers.push_back({ token, handler });
+					return token;
+				});
 		}
 
-		void operator-=(const GenericCallBack& _func) {
-			std::lock_guard<std::mutex> lock(m_lock);
-			m_func.erase(std::remove_if(m_func.begin(), m_func.end(),
-				[&_func](const auto& func) {
-					return func.target_type() == _func.target_type() &&
-						func.target<void(Args...)>() == _func.target<void(Args...)>();
-				}),
-				m_func.end());
+		// An invoke() already running may still call the removed handler once
+		bool operator-=(event_token _token)
+		{
+			return m_handlers.update([&](handler_list& _handlers)
+				{
+					auto it = std::find_if(_handlers.begin(), _handlers.end(), [&](const handler_entry& _entry)
+						{
+							return _entry.m_token == _token;
+						});
+
+					if (it == _handlers.end())
+						return false;
+
+					_handlers.erase(it);
+					return true;
+				});
 		}
 
+		void clear()
+		{
+			m_handlers.update([](handler_list& _handlers)
+				{
+					_handlers.clear();
+					return true;
+				});
+		}
 
-		void invoke(Args... args)
+		size_t size() const
 		{
-			std::lock_guard<std::mutex> lock(m_lock);
-			for (const auto& f : m_func)
+			return m_handlers.load()->size();
+		}
+
+		bool empty() const
+		{
+			return size() == 0;
+		}
+
+		void invoke(const Args&... args) const
+		{
+			auto handlers = m_handlers.load();
+			for (const auto& entry : *handlers)
 			{
-				try 
+				try
 				{
-					(*f)(args...);
+					(*entry.m_func)(args...);
 				}
 				catch (const std::exception& e) {
 					std::cerr << "Error in callback: " << e.what() << std::endl;
@@ -48,12 +98,94 @@ namespace afu
 			}
 		}
 
-		smart_event() = default;
+		// Posts every handler to _executor with one shared copy of the arguments and returns
+		// at once. The result completes when the last handler returned; get() throws if an
+		// action was dropped (the executor was destroyed with it still queued).
+		template<typename Executor>
+		async_result<void> invoke_async(Executor& _executor, const Args&... args) const
+		{
+			return post_handlers(_executor, std::tuple<std::decay_t<Args>...>(args...));
+		}
+
+		// Like invoke_async() but waits for every handler, the arguments are not copied.
+		// Do not call it from a thread of _executor itself.
+		template<typename Executor>
+		void invoke_parallel(Executor& _executor, const Args&... args) const
+		{
+			post_handlers(_executor, std::tuple<const Args&...>(args...)).get();
+		}
 
 
 	private:
-		std::vector<std::shared_ptr<GenericCallBack>> m_func;
-		std::mutex m_lock;
+
+		struct handler_entry
+		{
+			event_token m_token;
+			std::shared_ptr<const GenericCallBack> m_func;  // shared between snapshots
+		};
+
+		using handler_list = std::vector<handler_entry>;
+
+		// One invoke_async() / invoke_parallel() call, shared by its posted actions. Dropped
+		// actions release it too, so the promise then completes with an exception.
+		template<typename Tuple>
+		struct async_call
+		{
+			std::shared_ptr<const handler_list> m_handlers;
+			Tuple m_args;
+			std::atomic<size_t> m_remaining;
+			async_promise<void> m_promise;
+
+			async_call(std::shared_ptr<const handler_list> _handlers, Tuple&& _args, async_promise<void>&& _promise) :
+				m_handlers(std::move(_handlers)),
+				m_args(std::move(_args)),
+				m_remaining(m_handlers->size()),
+				m_promise(std::move(_promise))
+			{}
+
+			void run(size_t _index)
+			{
+				try
+				{
+					std::apply(*(*m_handlers)[_index].m_func, m_args);
+				}
+				catch (const std::exception& e) {
+					std::cerr << "Error in callback: " << e.what() << std::endl;
+				}
+				done();
+			}
+
+			void done()
+			{
+				if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					m_promise.set_value();
+			}
+		};
+
+		template<typename Executor, typename Tuple>
+		async_result<void> post_handlers(Executor& _executor, Tuple&& _args) const
+		{
+			auto handlers = m_handlers.load();
+			async_promise<void> promise;
+			auto result = promise.get_result();
+			if (handlers->empty())
+			{
+				promise.set_value();
+				return result;
+			}
+
+			auto call = std::make_shared<async_call<std::decay_t<Tuple>>>(handlers, std::move(_args), std::move(promise));
+			for (size_t i = 0; i < handlers->size(); ++i)
+			{
+				// refused by a bounded executor : counts as done, the handler is skipped
+				if (!_executor.post([call, i]() { call->run(i); }))
+					call->done();
+			}
+			return result;
+		}
+
+		afu::snapshot_ptr<handler_list> m_handlers;
+		event_token m_last_token = 0;  // guarded by the snapshot writer lock
 
 	};
 }
@@ -0,0 +1,207 @@
+#pragma once
+// Schwartz Liran
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Instrumentation : latency histograms and counters for dispatchers and subscribers.
+// Build with AFU_ENABLE_INSTRUMENTATION=1 to record. Otherwise every AFU_INSTRUMENT(...)
+// statement disappears and the snapshot API returns empty histograms.
+#ifndef AFU_ENABLE_INSTRUMENTATION
+#define AFU_ENABLE_INSTRUMENTATION 0
+#endif
+
+// The setting changes class layouts, every translation unit of a program must agree on it
+// (the afu CMake target carries it). The MSVC linker rejects a mix.
+#if AFU_ENABLE_INSTRUMENTATION
+#define AFU_INSTRUMENT(...) __VA_ARGS__
+#if defined(_MSC_VER)
+#pragma detect_mismatch("AFU_ENABLE_INSTRUMENTATION", "1")
+#endif
+#else
+#define AFU_INSTRUMENT(...)
+#if defined(_MSC_VER)
+#pragma detect_mismatch("AFU_ENABLE_INSTRUMENTATION", "0")
+#endif
+#endif
+
+namespace afu
+{
+
+	inline std::uint64_t instrument_now_ns() noexcept
+	{
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+
+	// Copy of a latency_histogram, values in nanoseconds
+	struct histogram_snapshot
+	{
+		std::uint64_t count = 0;
+		std::uint64_t sum = 0;
+		std::uint64_t min = 0;
+		std::uint64_t max = 0;
+		std::vector<std::uint64_t> buckets;
+
+		double mean() const noexcept
+		{
+			return count == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(count);
+		}
+
+		// Upper bound of the bucket holding the _percentile (0..100) sample
+		std::uint64_t percentile(double _percentile) const;
+	};
+
+
+	// Log-linear histogram in the HDR style : exact below 32, then 16 sub-buckets per
+	// power of two (about 6% precision) up to 2^64. record() is a few relaxed atomics.
+	class latency_histogram
+	{
+	public:
+
+		static constexpr unsigned SUB_BUCKET_BITS = 4;
+		static constexpr unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+		static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	private:
+
+		std::array<std::atomic<std::uint64_t>, BUCKET_COUNT> m_buckets{};
+		std::atomic<std::uint64_t> m_count{ 0 };
+		std::atomic<std::uint64_t> m_sum{ 0 };
+		std::atomic<std::uint64_t> m_min{ UINT64_MAX };
+		std::atomic<std::uint64_t> m_max{ 0 };
+
+	public:
+
+		latency_histogram() = default;
+
+		latency_histogram(const latency_histogram& other) = delete;
+
+		static size_t bucket_index(std::uint64_t _value) noexcept
+		{
+			if (_value < 2 * SUB_BUCKETS)
+				return static_cast<size_t>(_value);
+
+			auto exponent = highest_bit(_value) - SUB_BUCKET_BITS;
+			return static_cast<size_t>(exponent) * SUB_BUCKETS + static_cast<size_t>(_value >> exponent);
+		}
+
+		static std::uint64_t bucket_upper_bound(size_t _index) noexcept
+		{
+			if (_index < 2 * SUB_BUCKETS)
+				return _index;
+
+			auto exponent = _index / SUB_BUCKETS - 1;
+			auto mantissa = _index % SUB_BUCKETS + SUB_BUCKETS;
+			return (static_cast<std::uint64_t>(mantissa) << exponent) + ((std::uint64_t(1) << exponent) - 1);
+		}
+
+		void record(std::uint64_t _value) noexcept
+		{
+			m_buckets[bucket_index(_value)].fetch_add(1, std::memory_order_relaxed);
+			m_count.fetch_add(1, std::memory_order_relaxed);
+			m_sum.fetch_add(_value, std::memory_order_relaxed);
+
+			auto low = m_min.load(std::memory_order_relaxed);
+			while (_value < low && !m_min.compare_exchange_weak(low, _value, std::memory_order_relaxed))
+			{
+			}
+
+			auto high = m_max.load(std::memory_order_relaxed);
+			while (_value > high && !m_max.compare_exchange_weak(high, _value, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		// Not atomic as a whole, a record() running at the same time may be half in it
+		histogram_snapshot snapshot() const
+		{
+			histogram_snapshot snap;
+			snap.count = m_count.load(std::memory_order_relaxed);
+			snap.sum = m_sum.load(std::memory_order_relaxed);
+			snap.min = snap.count == 0 ? 0 : m_min.load(std::memory_order_relaxed);
+			snap.max = m_max.load(std::memory_order_relaxed);
+			snap.buckets.resize(BUCKET_COUNT);
+			for (size_t i = 0; i < BUCKET_COUNT; ++i)
+				snap.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+
+			return snap;
+		}
+
+		void reset() noexcept
+		{
+			for (auto& bucket : m_buckets)
+				bucket.store(0, std::memory_order_relaxed);
+
+			m_count.store(0, std::memory_order_relaxed);
+			m_sum.store(0, std::memory_order_relaxed);
+			m_min.store(UINT64_MAX, std::memory_order_relaxed);
+			m_max.store(0, std::memory_order_relaxed);
+		}
+
+	private:
+
+		static unsigned highest_bit(std::uint64_t _value) noexcept
+		{
+#if defined(__GNUC__) || defined(__clang__)
+			return 63u - static_cast<unsigned>(__builtin_clzll(_value));
+#else
+			unsigned bit = 0;
+			while (_value >>= 1)
+				++bit;
+
+			return bit;
+#endif
+		}
+	};
+
+
+	inline std::uint64_t histogram_snapshot::percentile(double _percentile) const
+	{
+		if (count == 0 || buckets.empty())
+			return 0;
+
+		auto rank = static_cast<std::uint64_t>(_percentile / 100.0 * static_cast<double>(count) + 0.5);
+		if (rank == 0)
+			rank = 1;
+
+		std::uint64_t seen = 0;
+		for (size_t i = 0; i < buckets.size(); ++i)
+		{
+			seen += buckets[i];
+			if (seen >= rank)
+			{
+				auto bound = latency_histogram::bucket_upper_bound(i);
+				return bound < max ? bound : max;
+			}
+		}
+		return max;
+	}
+
+
+	// Time an action spent queued and running on a dispatcher
+	struct dispatcher_metrics
+	{
+		latency_histogram m_queue_wait;
+		latency_histogram m_execution;
+
+		void record(std::uint64_t _enqueued_ns, std::uint64_t _start_ns, std::uint64_t _end_ns) noexcept
+		{
+			m_queue_wait.record(_start_ns - _enqueued_ns);
+			m_execution.record(_end_ns - _start_ns);
+		}
+	};
+
+	// Subscriber fan-out counters, publish to end of callback latency
+	struct subscriber_metrics
+	{
+		std::atomic<std::uint64_t> m_deliveries{ 0 };  // actions handed to dispatchers
+		std::atomic<std::uint64_t> m_callbacks{ 0 };   // samples that went through a callback
+		latency_histogram m_end_to_end;
+	};
+
+}
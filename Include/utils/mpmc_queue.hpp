@@ -0,0 +1,323 @@
+#pragma once
+// Schwartz Liran
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <utils/mpsc_queue.hpp>
+#include <utils/thread_utils.hpp>
+
+// Bounded multi-producer / multi-consumer queue (Vyukov's array queue).
+// Every cell carries a sequence number, so push and pop are one CAS on their own
+// index plus the cell hand-over, with no lock. Only a thread that has to wait takes
+// the mutex : producers and consumers notify one sleeper, and only when someone sleeps.
+// close() wakes every waiter, pushes then fail and pops drain what is left.
+namespace afu
+{
+
+	template<typename T>
+	class mpmc_queue
+	{
+	private:
+
+		struct cell
+		{
+			std::atomic<size_t> m_sequence;
+			alignas(T) unsigned char m_bytes[sizeof(T)];
+
+			T* value() noexcept
+			{
+				return std::launder(reinterpret_cast<T*>(m_bytes));
+			}
+		};
+
+		std::unique_ptr<cell[]> m_cells;
+		size_t m_mask;
+
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_enqueue_pos{ 0 };
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_dequeue_pos{ 0 };
+
+		alignas(CACHE_LINE_SIZE) std::atomic<bool> m_closed{ false };
+		std::atomic<int> m_pop_waiters{ 0 };
+		std::atomic<int> m_push_waiters{ 0 };
+		std::mutex m_wait_mutex;
+		std::condition_variable m_not_empty;
+		std::condition_variable m_not_full;
+		std::chrono::nanoseconds m_spin_budget{ 0 };
+
+		static size_t round_up(size_t _capacity)
+		{
+			size_t capacity = 2;
+			while (capacity < _capacity)
+				capacity <<= 1;
+
+			return capacity;
+		}
+
+		bool readable() const noexcept
+		{
+			auto pos = m_dequeue_pos.load(std::memory_order_relaxed);
+			return m_cells[pos & m_mask].m_sequence.load(std::memory_order_acquire) == pos + 1;
+		}
+
+		bool writable() const noexcept
+		{
+			auto pos = m_enqueue_pos.load(std::memory_order_relaxed);
+			return m_cells[pos & m_mask].m_sequence.load(std::memory_order_acquire) == pos;
+		}
+
+		// Dekker pair with the waiter count taken in wait()
+		void wake_one(std::atomic<int>& _waiters, std::condition_variable& _cv)
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (_waiters.load(std::memory_order_relaxed) == 0)
+				return;
+
+			{
+				std::lock_guard<std::mutex> lock(m_wait_mutex);
+			}
+			_cv.notify_one();
+		}
+
+		// false when the deadline passed first
+		template<typename F>
+		bool wait(std::atomic<int>& _waiters, std::condition_variable& _cv, F&& _ready,
+			std::chrono::steady_clock::time_point _deadline)
+		{
+			if (spin_until(m_spin_budget, _ready))
+				return true;
+
+			std::unique_lock<std::mutex> lock(m_wait_mutex);
+			_waiters.fetch_add(1, std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			bool ready;
+			if (_deadline == std::chrono::steady_clock::time_point::max())
+			{
+				_cv.wait(lock, _ready);
+				ready = true;
+			}
+			else
+			{
+				ready = _cv.wait_until(lock, _deadline, _ready);
+			}
+			_waiters.fetch_sub(1, std::memory_order_relaxed);
+			return ready;
+		}
+
+		template<typename... Args>
+		bool enqueue(Args&&... _args)
+		{
+			auto pos = m_enqueue_pos.load(std::memory_order_relaxed);
+			cell* target;
+			while (true)
+			{
+				target = &m_cells[pos & m_mask];
+				auto sequence = target->m_sequence.load(std::memory_order_acquire);
+				auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+				if (diff == 0)
+				{
+					if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					pos = m_enqueue_pos.load(std::memory_order_relaxed);
+				}
+			}
+
+			new (target->m_bytes) T(std::forward<Args>(_args)...);
+			target->m_sequence.store(pos + 1, std::memory_order_release);
+			wake_one(m_pop_waiters, m_not_empty);
+			return true;
+		}
+
+	public:
+
+		explicit mpmc_queue(size_t _capacity) :
+			m_cells(new cell[round_up(_capacity)]),
+			m_mask(round_up(_capacity) - 1)
+		{
+			for (size_t i = 0; i <= m_mask; ++i)
+				m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+		}
+
+		mpmc_queue(const mpmc_queue& other) = delete;
+
+		~mpmc_queue()
+		{
+			auto tail = m_enqueue_pos.load(std::memory_order_acquire);
+			for (auto pos = m_dequeue_pos.load(std::memory_order_acquire); pos != tail; ++pos)
+			{
+				auto& remaining = m_cells[pos & m_mask];
+				if (remaining.m_sequence.load(std::memory_order_acquire) == pos + 1)
+					remaining.value()->~T();
+			}
+		}
+
+		size_t capacity() const noexcept
+		{
+			return m_mask + 1;
+		}
+
+		// busy-poll this long before a waiting push / pop sleeps
+		void set_spin_budget(std::chrono::nanoseconds _budget)
+		{
+			m_spin_budget = _budget;
+		}
+
+		// approximate while other threads are working
+		size_t size() const noexcept
+		{
+			auto tail = m_enqueue_pos.load(std::memory_order_acquire);
+			auto head = m_dequeue_pos.load(std::memory_order_acquire);
+			return tail > head ? tail - head : 0;
+		}
+
+		bool empty() const noexcept
+		{
+			return size() == 0;
+		}
+
+		bool is_closed() const noexcept
+		{
+			return m_closed.load();
+		}
+
+		// Fails pushes from now on and wakes every waiting thread
+		void close()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_wait_mutex);
+				m_closed.store(true);
+			}
+			m_not_empty.notify_all();
+			m_not_full.notify_all();
+		}
+
+		// false when full or closed, _value is then left untouched
+		template<typename U>
+		bool try_push(U&& _value)
+		{
+			return try_emplace(std::forward<U>(_value));
+		}
+
+		template<typename... Args>
+		bool try_emplace(Args&&... _args)
+		{
+			if (m_closed.load(std::memory_order_relaxed))
+				return false;
+
+			return enqueue(std::forward<Args>(_args)...);
+		}
+
+		// Waits for room, false once the queue is closed
+		template<typename U>
+		bool push(U&& _value)
+		{
+			return emplace(std::forward<U>(_value));
+		}
+
+		template<typename... Args>
+		bool emplace(Args&&... _args)
+		{
+			while (true)
+			{
+				if (m_closed.load())
+					return false;
+
+				if (enqueue(std::forward<Args>(_args)...))
+					return true;
+
+				wait(m_push_waiters, m_not_full, [&]() { return writable() || m_closed.load(); },
+					std::chrono::steady_clock::time_point::max());
+			}
+		}
+
+		bool try_pop(T& _out)
+		{
+			return pop_bulk(&_out, 1) == 1;
+		}
+
+		// Moves out up to _max ready elements, claimed with a single CAS. Does not wait.
+		size_t pop_bulk(T* _out, size_t _max)
+		{
+			if (_max == 0)
+				return 0;
+
+			auto pos = m_dequeue_pos.load(std::memory_order_relaxed);
+			size_t count;
+			while (true)
+			{
+				count = 0;
+				while (count < _max &&
+					m_cells[(pos + count) & m_mask].m_sequence.load(std::memory_order_acquire) == pos + count + 1)
+				{
+					++count;
+				}
+
+				if (count == 0)
+				{
+					// empty, or another consumer moved on and pos is stale
+					auto current = m_dequeue_pos.load(std::memory_order_relaxed);
+					if (current == pos)
+						return 0;
+
+					pos = current;
+					continue;
+				}
+
+				if (m_dequeue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+					break;
+			}
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				auto& source = m_cells[(pos + i) & m_mask];
+				_out[i] = std::move(*source.value());
+				source.value()->~T();
+				source.m_sequence.store(pos + i + m_mask + 1, std::memory_order_release);
+			}
+
+			wake_one(m_push_waiters, m_not_full);
+			return count;
+		}
+
+		// Waits for an element, false once the queue is closed and empty
+		bool pop(T& _out)
+		{
+			return pop_until(_out, std::chrono::steady_clock::time_point::max());
+		}
+
+		template<typename Rep, typename Period>
+		bool pop_for(T& _out, std::chrono::duration<Rep, Period> _timeout)
+		{
+			return pop_until(_out, std::chrono::steady_clock::now() + _timeout);
+		}
+
+		bool pop_until(T& _out, std::chrono::steady_clock::time_point _deadline)
+		{
+			while (true)
+			{
+				if (try_pop(_out))
+					return true;
+
+				if (m_closed.load())
+					return try_pop(_out);
+
+				if (!wait(m_pop_waiters, m_not_empty, [&]() { return readable() || m_closed.load(); }, _deadline))
+					return try_pop(_out);
+			}
+		}
+	};
+
+}
@@ -0,0 +1,165 @@
+#pragma once
+// Schwartz Liran
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Lock-free multi-producer / single-consumer queue (Vyukov intrusive node queue).
+// push() is one atomic exchange plus one store and never waits for the consumer,
+// try_pop() may only be called from one thread at a time.
+// Popped nodes go back to a free list that push() reuses, so a queue in steady state
+// does not allocate. A producer that finds the free list busy allocates instead of waiting.
+namespace afu
+{
+
+	static constexpr size_t CACHE_LINE_SIZE = 64;
+
+	template<typename T>
+	class mpsc_queue
+	{
+	private:
+
+		struct node
+		{
+			std::atomic<node*> m_next;
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+
+			node() :
+				m_next(nullptr)
+			{}
+
+			T& value() noexcept
+			{
+				return *reinterpret_cast<T*>(&m_storage);
+			}
+		};
+
+		static constexpr size_t DEFAULT_FREE_LIMIT = 4096;
+
+		// producers and the consumer work on different cache lines
+		alignas(CACHE_LINE_SIZE) std::atomic<node*> m_tail;
+		alignas(CACHE_LINE_SIZE) node* m_head;
+
+		// Free list : the consumer pushes lock-free, producers pop one at a time behind
+		// m_free_busy, which rules out the ABA problem of a plain Treiber stack.
+		alignas(CACHE_LINE_SIZE) std::atomic<node*> m_free{ nullptr };
+		std::atomic_flag m_free_busy = ATOMIC_FLAG_INIT;
+		std::atomic<size_t> m_free_count{ 0 };
+		size_t m_free_limit;
+
+	public:
+
+		explicit mpsc_queue(size_t _free_limit = DEFAULT_FREE_LIMIT) :
+			m_free_limit(_free_limit)
+		{
+			auto stub = new node();
+			m_head = stub;
+			m_tail.store(stub, std::memory_order_relaxed);
+		}
+
+		mpsc_queue(const mpsc_queue& other) = delete;
+
+		~mpsc_queue()
+		{
+			auto n = m_head->m_next.load(std::memory_order_acquire);
+			delete m_head;
+			while (n != nullptr)
+			{
+				auto next = n->m_next.load(std::memory_order_acquire);
+				n->value().~T();
+				delete n;
+				n = next;
+			}
+
+			auto f = m_free.load(std::memory_order_acquire);
+			while (f != nullptr)
+			{
+				auto next = f->m_next.load(std::memory_order_relaxed);
+				delete f;
+				f = next;
+			}
+		}
+
+		template<typename U>
+		void push(U&& _value)
+		{
+			auto n = acquire_node();
+			try
+			{
+				new (&n->m_storage) T(std::forward<U>(_value));
+			}
+			catch (...)
+			{
+				release_node(n);
+				throw;
+			}
+
+			auto prev = m_tail.exchange(n, std::memory_order_acq_rel);
+			prev->m_next.store(n, std::memory_order_release);
+		}
+
+		// consumer only
+		bool try_pop(T& _out)
+		{
+			auto head = m_head;
+			auto next = head->m_next.load(std::memory_order_acquire);
+			if (next == nullptr)
+				return false;
+
+			// next becomes the new stub, its value moves out
+			_out = std::move(next->value());
+			next->value().~T();
+			m_head = next;
+			release_node(head);
+			return true;
+		}
+
+		// consumer only. A push that is half way through may not be visible yet.
+		bool empty() const
+		{
+			return m_head->m_next.load(std::memory_order_acquire) == nullptr;
+		}
+
+	private:
+
+		node* acquire_node()
+		{
+			if (m_free.load(std::memory_order_relaxed) != nullptr && !m_free_busy.test_and_set(std::memory_order_acquire))
+			{
+				auto n = m_free.load(std::memory_order_acquire);
+				while (n != nullptr && !m_free.compare_exchange_weak(n, n->m_next.load(std::memory_order_relaxed), std::memory_order_acquire))
+				{
+				}
+				m_free_busy.clear(std::memory_order_release);
+
+				if (n != nullptr)
+				{
+					m_free_count.fetch_sub(1, std::memory_order_relaxed);
+					n->m_next.store(nullptr, std::memory_order_relaxed);
+					return n;
+				}
+			}
+			return new node();
+		}
+
+		void release_node(node* _node)
+		{
+			if (m_free_count.load(std::memory_order_relaxed) >= m_free_limit)
+			{
+				delete _node;
+				return;
+			}
+
+			m_free_count.fetch_add(1, std::memory_order_relaxed);
+			auto top = m_free.load(std::memory_order_relaxed);
+			do
+			{
+				_node->m_next.store(top, std::memory_order_relaxed);
+			} while (!m_free.compare_exchange_weak(top, _node, std::memory_order_release, std::memory_order_relaxed));
+		}
+	};
+
+}
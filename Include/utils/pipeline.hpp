@@ -0,0 +1,549 @@
+#pragma once
+// Schwartz Liran
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <interface/worker_interface.h>
+#include <utils/collection.hpp>
+#include <utils/span.hpp>
+#include <utils/thread_utils.hpp>
+
+// Pipeline : a chain of worker_interface stages, each on its own thread, connected
+// by bounded SPSC rings. A stage takes everything waiting in its input ring (up to
+// its batch size) in one go and wakes the next stage once per batch, so a busy chain
+// hands work over without a mutex or a condition variable at any hop.
+//
+//	auto chain = afu::make_pipeline(decoder)
+//		.then(transformer)
+//		.build(publisher);
+//	chain->start();
+namespace afu
+{
+
+	// Ring between two stages. The consumer parks on m_consumer when the ring is empty,
+	// a producer parks on m_producer while it is full (back-pressure).
+	template<typename T>
+	struct pipeline_link
+	{
+		spsc_ring<T> m_ring;
+		thread_parker m_consumer;
+		thread_parker m_producer;
+		std::atomic_bool m_closed{ false };  // consumer is gone, emit() fails
+
+		explicit pipeline_link(size_t _capacity) :
+			m_ring(_capacity)
+		{}
+
+		bool has_room() const noexcept
+		{
+			return m_ring.size() < m_ring.capacity() || m_closed.load();
+		}
+	};
+
+
+	// Producer end of a link, handed to produce() / process()
+	template<typename T>
+	class stage_output
+	{
+	private:
+
+		std::shared_ptr<pipeline_link<T>> m_link;
+		std::chrono::nanoseconds m_spin_budget{ 0 };
+		size_t m_pending = 0;
+
+	public:
+
+		void connect(std::shared_ptr<pipeline_link<T>> _link)
+		{
+			m_link = std::move(_link);
+		}
+
+		void set_spin_budget(std::chrono::nanoseconds _budget)
+		{
+			m_spin_budget = _budget;
+		}
+
+		// Waits while the ring is full. False when nothing is connected or the consumer stopped.
+		template<typename U>
+		bool emit(U&& _value)
+		{
+			if (m_link == nullptr)
+				return false;
+
+			while (!m_link->m_ring.try_push(std::forward<U>(_value)))
+			{
+				flush();
+				if (m_link->m_closed.load())
+					return false;
+
+				auto room = [&]() { return m_link->has_room(); };
+				if (!spin_until(m_spin_budget, room))
+					m_link->m_producer.park(room);
+			}
+
+			++m_pending;
+			return true;
+		}
+
+		// Wakes the consumer for everything emitted since the last flush
+		void flush()
+		{
+			if (m_pending == 0)
+				return;
+
+			m_pending = 0;
+			m_link->m_consumer.unpark();
+		}
+	};
+
+
+	// Thread handling shared by every stage
+	class pipeline_stage :
+		public worker_interface
+	{
+	protected:
+
+		std::thread m_thread;
+		std::atomic_bool m_running{ false };
+		thread_config m_thread_config;
+		size_t m_batch_size = 64;
+
+		virtual void run() = 0;
+
+		// wakes the stage thread out of its idle wait
+		virtual void wake()
+		{}
+
+	public:
+
+		virtual ~pipeline_stage() = default;
+
+		// call before start()
+		void set_thread_config(const thread_config& _config)
+		{
+			m_thread_config = _config;
+		}
+
+		// call before start(), most items taken from the input ring per process() / consume()
+		void set_batch_size(size_t _batch_size)
+		{
+			if (_batch_size == 0)
+				throw std::invalid_argument("pipeline_stage batch size must be positive");
+
+			m_batch_size = _batch_size;
+		}
+
+		bool is_running() const noexcept
+		{
+			return m_running.load();
+		}
+
+		virtual void init() override
+		{}
+
+		virtual void start() override
+		{
+			if (m_thread.joinable())
+				return;
+
+			m_running = true;
+			m_thread = std::thread([this]()
+				{
+					apply_thread_config(m_thread_config);
+					run();
+				});
+		}
+
+		// A consuming stage finishes what is already in its input ring before it returns
+		virtual void stop() override
+		{
+			m_running = false;
+			wake();
+			if (m_thread.joinable() && m_thread.get_id() != std::this_thread::get_id())
+				m_thread.join();
+		}
+	};
+
+
+	// First stage. produce() is called in a loop and returns false when it had nothing
+	// to emit, the stage then yields before polling again. Keep it short so stop() is seen.
+	template<typename Out>
+	class source_stage :
+		public pipeline_stage
+	{
+	public:
+
+		using output_type = Out;
+
+		void set_output(std::shared_ptr<pipeline_link<Out>> _link)
+		{
+			m_output.connect(std::move(_link));
+		}
+
+	protected:
+
+		stage_output<Out> m_output;
+
+		virtual bool produce(stage_output<Out>& _out) = 0;
+
+		void run() override
+		{
+			m_output.set_spin_budget(m_thread_config.spin_budget);
+			while (m_running)
+			{
+				bool produced = produce(m_output);
+				m_output.flush();
+				if (!produced)
+					std::this_thread::yield();
+			}
+		}
+	};
+
+
+	// Stage reading an input ring in batches
+	template<typename In>
+	class consuming_stage :
+		public pipeline_stage
+	{
+	public:
+
+		using input_type = In;
+
+		void set_input(std::shared_ptr<pipeline_link<In>> _link)
+		{
+			m_input = std::move(_link);
+		}
+
+	protected:
+
+		std::shared_ptr<pipeline_link<In>> m_input;
+
+		virtual void on_batch(span<In> _batch) = 0;
+
+		void wake() override
+		{
+			if (m_input != nullptr)
+				m_input->m_consumer.unpark();
+		}
+
+		void run() override
+		{
+			if (m_input == nullptr)
+				return;
+
+			auto& ring = m_input->m_ring;
+			auto ready = [&]() { return !ring.empty() || !m_running; };
+
+			while (true)
+			{
+				// processed in place, the slots are released once on_batch() returns
+				auto batch = ring.peek();
+				if (batch.empty())
+				{
+					// stopped : leave once the ring is drained
+					if (!m_running)
+					{
+						if (ring.empty())
+							break;
+
+						continue;
+					}
+
+					if (!spin_until(m_thread_config.spin_budget, ready))
+						m_input->m_consumer.park(ready);
+
+					continue;
+				}
+
+				if (batch.size() > m_batch_size)
+					batch = batch.subspan(0, m_batch_size);
+
+				on_batch(batch);
+				ring.consume(batch.size());
+				m_input->m_producer.unpark();
+			}
+
+			m_input->m_closed = true;
+			m_input->m_producer.unpark();
+		}
+	};
+
+
+	// Middle stage, process() emits any number of outputs per batch
+	template<typename In, typename Out>
+	class transform_stage :
+		public consuming_stage<In>
+	{
+	public:
+
+		using output_type = Out;
+
+		void set_output(std::shared_ptr<pipeline_link<Out>> _link)
+		{
+			m_output.connect(std::move(_link));
+		}
+
+	protected:
+
+		stage_output<Out> m_output;
+
+		virtual void process(span<In> _batch, stage_output<Out>& _out) = 0;
+
+		void run() override
+		{
+			m_output.set_spin_budget(this->m_thread_config.spin_budget);
+			consuming_stage<In>::run();
+		}
+
+		void on_batch(span<In> _batch) override
+		{
+			process(_batch, m_output);
+			m_output.flush();
+		}
+	};
+
+
+	// Last stage
+	template<typename In>
+	class sink_stage :
+		public consuming_stage<In>
+	{
+	protected:
+
+		virtual void consume(span<In> _batch) = 0;
+
+		void on_batch(span<In> _batch) override
+		{
+			consume(_batch);
+		}
+	};
+
+
+	// Lambda stages : bool(stage_output<Out>&), void(span<In>, stage_output<Out>&), void(span<In>)
+	template<typename Out, typename F>
+	class function_source :
+		public source_stage<Out>
+	{
+	private:
+
+		F m_func;
+
+	public:
+
+		explicit function_source(F _func) :
+			m_func(std::move(_func))
+		{}
+
+	protected:
+
+		bool produce(stage_output<Out>& _out) override
+		{
+			return m_func(_out);
+		}
+	};
+
+	template<typename In, typename Out, typename F>
+	class function_transform :
+		public transform_stage<In, Out>
+	{
+	private:
+
+		F m_func;
+
+	public:
+
+		explicit function_transform(F _func) :
+			m_func(std::move(_func))
+		{}
+
+	protected:
+
+		void process(span<In> _batch, stage_output<Out>& _out) override
+		{
+			m_func(_batch, _out);
+		}
+	};
+
+	template<typename In, typename F>
+	class function_sink :
+		public sink_stage<In>
+	{
+	private:
+
+		F m_func;
+
+	public:
+
+		explicit function_sink(F _func) :
+			m_func(std::move(_func))
+		{}
+
+	protected:
+
+		void consume(span<In> _batch) override
+		{
+			m_func(_batch);
+		}
+	};
+
+	template<typename Out, typename F>
+	std::shared_ptr<source_stage<Out>> make_source(F&& _func)
+	{
+		return std::make_shared<function_source<Out, std::decay_t<F>>>(std::forward<F>(_func));
+	}
+
+	template<typename In, typename Out, typename F>
+	std::shared_ptr<transform_stage<In, Out>> make_transform(F&& _func)
+	{
+		return std::make_shared<function_transform<In, Out, std::decay_t<F>>>(std::forward<F>(_func));
+	}
+
+	template<typename In, typename F>
+	std::shared_ptr<sink_stage<In>> make_sink(F&& _func)
+	{
+		return std::make_shared<function_sink<In, std::decay_t<F>>>(std::forward<F>(_func));
+	}
+
+
+	// Built chain, stages are kept source first
+	class pipeline :
+		public worker_interface
+	{
+	private:
+
+		std::vector<std::shared_ptr<pipeline_stage>> m_stages;
+		bool m_started = false;
+
+	public:
+
+		pipeline() = default;
+
+		pipeline(const pipeline& other) = delete;
+
+		~pipeline()
+		{
+			stop();
+		}
+
+		void add_stage(std::shared_ptr<pipeline_stage> _stage)
+		{
+			m_stages.push_back(std::move(_stage));
+		}
+
+		size_t size() const noexcept
+		{
+			return m_stages.size();
+		}
+
+		// call before start(), every stage gets _config with its index as name suffix
+		void set_thread_config(const thread_config& _config)
+		{
+			for (size_t i = 0; i < m_stages.size(); ++i)
+				m_stages[i]->set_thread_config(indexed_thread_config(_config, i));
+		}
+
+		void init() override
+		{
+			for (auto& stage : m_stages)
+				stage->init();
+		}
+
+		// Consumers first, so every ring has a reader before anything is written to it
+		void start() override
+		{
+			if (m_started)
+				return;
+
+			m_started = true;
+			for (auto it = m_stages.rbegin(); it != m_stages.rend(); ++it)
+				(*it)->start();
+		}
+
+		// Source first, each stage then drains its input before the next one is stopped
+		void stop() override
+		{
+			if (!m_started)
+				return;
+
+			m_started = false;
+			for (auto& stage : m_stages)
+				stage->stop();
+		}
+	};
+
+
+	template<typename T>
+	class pipeline_builder
+	{
+	private:
+
+		std::shared_ptr<pipeline> m_pipeline;
+		std::function<void(std::shared_ptr<pipeline_link<T>>)> m_connect_output;
+
+		template<typename U>
+		friend class pipeline_builder;
+
+		template<typename Stage>
+		friend pipeline_builder<typename Stage::output_type> make_pipeline(std::shared_ptr<Stage> _source);
+
+		template<typename Stage>
+		pipeline_builder(std::shared_ptr<pipeline> _pipeline, const std::shared_ptr<Stage>& _producer) :
+			m_pipeline(std::move(_pipeline)),
+			m_connect_output([_producer](std::shared_ptr<pipeline_link<T>> _link)
+				{
+					_producer->set_output(std::move(_link));
+				})
+		{
+			m_pipeline->add_stage(_producer);
+		}
+
+		template<typename Stage>
+		void connect(const std::shared_ptr<Stage>& _consumer, size_t _capacity)
+		{
+			static_assert(std::is_same<typename Stage::input_type, T>::value, "stage input type does not match the previous output");
+
+			if (m_pipeline == nullptr)
+				throw std::logic_error("pipeline_builder already used");
+
+			auto link = std::make_shared<pipeline_link<T>>(_capacity);
+			m_connect_output(link);
+			_consumer->set_input(std::move(link));
+		}
+
+	public:
+
+		static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+		// Adds a transform_stage reading this builder's output through a ring of _capacity
+		template<typename Stage>
+		pipeline_builder<typename Stage::output_type> then(std::shared_ptr<Stage> _stage, size_t _capacity = DEFAULT_CAPACITY)
+		{
+			connect(_stage, _capacity);
+			return pipeline_builder<typename Stage::output_type>(std::move(m_pipeline), _stage);
+		}
+
+		// Adds the sink_stage and returns the finished pipeline, not started yet
+		template<typename Stage>
+		std::shared_ptr<pipeline> build(std::shared_ptr<Stage> _sink, size_t _capacity = DEFAULT_CAPACITY)
+		{
+			connect(_sink, _capacity);
+			auto result = std::move(m_pipeline);
+			result->add_stage(std::move(_sink));
+			return result;
+		}
+	};
+
+	template<typename Stage>
+	pipeline_builder<typename Stage::output_type> make_pipeline(std::shared_ptr<Stage> _source)
+	{
+		return pipeline_builder<typename Stage::output_type>(std::make_shared<pipeline>(), _source);
+	}
+
+}
@@ -0,0 +1,144 @@
+#pragma once
+// Schwartz Liran
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+// Seqlock : lock-free "latest value" slot.
+// One writer at a time (callers serialize their writers), any number of readers that
+// copy the value out without locks and retry if a write overlapped the copy. The writer
+// is wait-free; a reader is only lock-free, a steady stream of writes can keep it retrying.
+namespace afu
+{
+
+	class seqlock_buffer
+	{
+	private:
+
+		std::atomic<std::uint64_t> m_sequence;
+		std::unique_ptr<unsigned char[]> m_data;
+		size_t m_size;
+
+	public:
+
+		explicit seqlock_buffer(size_t _size) :
+			m_sequence(0),
+			m_data(new unsigned char[_size == 0 ? 1 : _size]()),
+			m_size(_size)
+		{}
+
+		seqlock_buffer(const seqlock_buffer& other) = delete;
+
+		void store(const void* _src, size_t _size)
+		{
+			if (_size != m_size)
+				throw std::invalid_argument("size incorrect");
+
+			auto seq = m_sequence.load(std::memory_order_relaxed);
+			m_sequence.store(seq + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			std::memcpy(m_data.get(), _src, _size);
+
+			m_sequence.store(seq + 2, std::memory_order_release);
+		}
+
+		// false when nothing was stored yet, _version gets the number of stores seen
+		bool try_load(void* _dst, size_t _size, std::uint64_t& _version) const
+		{
+			if (_size != m_size)
+				throw std::invalid_argument("size incorrect");
+
+			while (true)
+			{
+				auto before = m_sequence.load(std::memory_order_acquire);
+				if (before == 0)
+					return false;
+
+				if (before & 1)
+					continue;
+
+				std::memcpy(_dst, m_data.get(), _size);
+				std::atomic_thread_fence(std::memory_order_acquire);
+
+				if (m_sequence.load(std::memory_order_relaxed) == before)
+				{
+					_version = before / 2;
+					return true;
+				}
+			}
+		}
+
+		// number of completed stores, cheap way for pollers to detect new data
+		std::uint64_t version() const
+		{
+			return m_sequence.load(std::memory_order_acquire) / 2;
+		}
+
+		size_t size() const noexcept { return m_size; }
+	};
+
+
+	template<typename T>
+	class seqlock_value
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+
+	private:
+
+		std::atomic<std::uint64_t> m_sequence;
+		T m_value;
+
+	public:
+
+		seqlock_value() :
+			m_sequence(0),
+			m_value()
+		{}
+
+		seqlock_value(const seqlock_value& other) = delete;
+
+		void store(const T& _val)
+		{
+			auto seq = m_sequence.load(std::memory_order_relaxed);
+			m_sequence.store(seq + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			std::memcpy(&m_value, &_val, sizeof(T));
+
+			m_sequence.store(seq + 2, std::memory_order_release);
+		}
+
+		bool try_load(T& _out, std::uint64_t& _version) const
+		{
+			while (true)
+			{
+				auto before = m_sequence.load(std::memory_order_acquire);
+				if (before == 0)
+					return false;
+
+				if (before & 1)
+					continue;
+
+				std::memcpy(&_out, &m_value, sizeof(T));
+				std::atomic_thread_fence(std::memory_order_acquire);
+
+				if (m_sequence.load(std::memory_order_relaxed) == before)
+				{
+					_version = before / 2;
+					return true;
+				}
+			}
+		}
+
+		std::uint64_t version() const
+		{
+			return m_sequence.load(std::memory_order_acquire) / 2;
+		}
+	};
+
+}
@@ -0,0 +1,101 @@
+#pragma once
+// Schwartz Liran
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// Snapshot : copy-on-write holder for read-mostly data (RCU style).
+// Readers take an immutable snapshot without locking, writers copy, modify and
+// swap the pointer under a writer-only mutex. Old snapshots die with their last reader.
+// std::atomic_load on a shared_ptr (and libstdc++'s atomic<shared_ptr>) takes a lock, so
+// the current shared_ptr lives in a holder reached through a plain atomic pointer.
+// A reader registers on the counter of the current epoch while it copies the shared_ptr
+// out, a writer flips the epoch and waits for the readers of the old one before it
+// deletes the old holder.
+namespace afu
+{
+
+	template<typename T>
+	class snapshot_ptr
+	{
+	private:
+
+		using holder = std::shared_ptr<const T>;
+
+		std::atomic<const holder*> m_current;
+		std::atomic<std::uint64_t> m_epoch{ 0 };
+		mutable std::atomic<size_t> m_readers[2] = {};
+		std::mutex m_write_lock;
+
+	public:
+
+		snapshot_ptr() :
+			m_current(new holder(std::make_shared<const T>()))
+		{}
+
+		explicit snapshot_ptr(T _initial) :
+			m_current(new holder(std::make_shared<const T>(std::move(_initial))))
+		{}
+
+		snapshot_ptr(const snapshot_ptr& other) = delete;
+
+		~snapshot_ptr()
+		{
+			delete m_current.load();
+		}
+
+		std::shared_ptr<const T> load() const
+		{
+			while (true)
+			{
+				auto epoch = m_epoch.load();
+				auto& readers = m_readers[epoch & 1];
+				readers.fetch_add(1);
+
+				// a writer flipped the epoch before we were counted, it may not wait for us
+				if (m_epoch.load() != epoch)
+				{
+					readers.fetch_sub(1);
+					continue;
+				}
+
+				std::shared_ptr<const T> snapshot = *m_current.load();
+				readers.fetch_sub(1);
+				return snapshot;
+			}
+		}
+
+		// _func(T&) edits a private copy that is published when it returns,
+		// returns what _func returned
+		template<typename F>
+		auto update(F&& _func)
+		{
+			std::lock_guard<std::mutex> lock(m_write_lock);
+			auto next = std::make_shared<T>(**m_current.load());
+			auto res = std::forward<F>(_func)(*next);
+			publish(new holder(std::move(next)));
+			return res;
+		}
+
+	private:
+
+		// writer lock held
+		void publish(const holder* _next)
+		{
+			auto previous = m_current.exchange(_next);
+			auto epoch = m_epoch.fetch_add(1);
+
+			// readers counted on the old epoch may still be copying from previous
+			while (m_readers[epoch & 1].load() != 0)
+				std::this_thread::yield();
+
+			delete previous;
+		}
+	};
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+// Schwartz Liran
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+// Span : non owning view over contiguous elements (pointer + size)
+namespace afu
+{
+
+	template<typename T>
+	class span
+	{
+	private:
+
+		T* m_data;
+		size_t m_size;
+
+	public:
+
+		using element_type = T;
+		using iterator = T*;
+
+		span() noexcept :
+			m_data(nullptr),
+			m_size(0)
+		{}
+
+		span(T* _data, size_t _size) noexcept :
+			m_data(_data),
+			m_size(_size)
+		{}
+
+		template<typename U, typename Alloc>
+		span(std::vector<U, Alloc>& _vec) noexcept :
+			m_data(_vec.data()),
+			m_size(_vec.size())
+		{}
+
+		template<typename U, typename Alloc>
+		span(const std::vector<U, Alloc>& _vec) noexcept :
+			m_data(_vec.data()),
+			m_size(_vec.size())
+		{}
+
+		T* data() const noexcept { return m_data; }
+
+		size_t size() const noexcept { return m_size; }
+
+		bool empty() const noexcept { return m_size == 0; }
+
+		iterator begin() const noexcept { return m_data; }
+
+		iterator end() const noexcept { return m_data + m_size; }
+
+		T& operator[](size_t _index) const noexcept { return m_data[_index]; }
+
+		T& at(size_t _index) const
+		{
+			if (_index >= m_size)
+				throw std::out_of_range("Index out of range!");
+
+			return m_data[_index];
+		}
+
+		T& front() const noexcept { return m_data[0]; }
+
+		T& back() const noexcept { return m_data[m_size - 1]; }
+
+		span subspan(size_t _offset, size_t _count) const noexcept
+		{
+			if (_offset > m_size)
+				_offset = m_size;
+
+			if (_count > m_size - _offset)
+				_count = m_size - _offset;
+
+			return span(m_data + _offset, _count);
+		}
+	};
+
+}
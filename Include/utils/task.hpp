@@ -0,0 +1,163 @@
+#pragma once
+// Schwartz Liran
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Task : move-only type-erased void() callable.
+// Captures up to INLINE_SIZE bytes are stored inside the task itself, larger ones
+// (or ones that may throw while moving) fall back to one heap allocation.
+namespace afu
+{
+
+	class task
+	{
+	public:
+
+		static constexpr size_t INLINE_SIZE = 48;
+
+	private:
+
+		using storage_type = typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type;
+
+		struct operations
+		{
+			void (*m_invoke)(void*);
+			void (*m_move)(void*, void*);  // move constructs into the first buffer, destroys the second
+			void (*m_destroy)(void*);
+		};
+
+		template<typename F>
+		struct inline_operations
+		{
+			static void invoke(void* _storage)
+			{
+				(*static_cast<F*>(_storage))();
+			}
+
+			static void move(void* _dst, void* _src)
+			{
+				new (_dst) F(std::move(*static_cast<F*>(_src)));
+				static_cast<F*>(_src)->~F();
+			}
+
+			static void destroy(void* _storage)
+			{
+				static_cast<F*>(_storage)->~F();
+			}
+
+			static constexpr operations table{ &invoke, &move, &destroy };
+		};
+
+		template<typename F>
+		struct heap_operations
+		{
+			static F*& target(void* _storage)
+			{
+				return *static_cast<F**>(_storage);
+			}
+
+			static void invoke(void* _storage)
+			{
+				(*target(_storage))();
+			}
+
+			static void move(void* _dst, void* _src)
+			{
+				new (_dst) F*(target(_src));
+			}
+
+			static void destroy(void* _storage)
+			{
+				delete target(_storage);
+			}
+
+			static constexpr operations table{ &invoke, &move, &destroy };
+		};
+
+		template<typename F>
+		static constexpr bool fits_inline = sizeof(F) <= INLINE_SIZE &&
+			alignof(std::max_align_t) % alignof(F) == 0 &&
+			std::is_nothrow_move_constructible<F>::value;
+
+		storage_type m_storage;
+		const operations* m_operations = nullptr;
+
+	public:
+
+		task() noexcept = default;
+
+		template<typename F, typename Func = typename std::decay<F>::type,
+			typename = typename std::enable_if<!std::is_same<Func, task>::value>::type>
+		task(F&& _func)
+		{
+			static_assert(std::is_invocable<Func&>::value, "task needs a void() callable");
+
+			if constexpr (fits_inline<Func>)
+			{
+				new (&m_storage) Func(std::forward<F>(_func));
+				m_operations = &inline_operations<Func>::table;
+			}
+			else
+			{
+				new (&m_storage) Func*(new Func(std::forward<F>(_func)));
+				m_operations = &heap_operations<Func>::table;
+			}
+		}
+
+		task(task&& other) noexcept :
+			m_operations(other.m_operations)
+		{
+			if (m_operations != nullptr)
+			{
+				m_operations->m_move(&m_storage, &other.m_storage);
+				other.m_operations = nullptr;
+			}
+		}
+
+		task& operator=(task&& other) noexcept
+		{
+			if (this != &other)
+			{
+				reset();
+				if (other.m_operations != nullptr)
+				{
+					other.m_operations->m_move(&m_storage, &other.m_storage);
+					m_operations = other.m_operations;
+					other.m_operations = nullptr;
+				}
+			}
+			return *this;
+		}
+
+		task(const task& other) = delete;
+		task& operator=(const task& other) = delete;
+
+		~task()
+		{
+			reset();
+		}
+
+		void operator()()
+		{
+			m_operations->m_invoke(&m_storage);
+		}
+
+		explicit operator bool() const noexcept
+		{
+			return m_operations != nullptr;
+		}
+
+		void reset() noexcept
+		{
+			if (m_operations != nullptr)
+			{
+				m_operations->m_destroy(&m_storage);
+				m_operations = nullptr;
+			}
+		}
+	};
+
+}
@@ -0,0 +1,217 @@
+#pragma once
+// Schwartz Liran
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+// without min / max macros, they break numeric_limits<>::max() and time_point::max()
+#ifndef NOMINMAX
+#define NOMINMAX
+#define AFU_UNDEF_NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#define AFU_UNDEF_WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#ifdef AFU_UNDEF_NOMINMAX
+#undef NOMINMAX
+#undef AFU_UNDEF_NOMINMAX
+#endif
+#ifdef AFU_UNDEF_WIN32_LEAN_AND_MEAN
+#undef WIN32_LEAN_AND_MEAN
+#undef AFU_UNDEF_WIN32_LEAN_AND_MEAN
+#endif
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+// Thread configuration for latency sensitive workers : spin budget before parking,
+// CPU pinning, real-time priority and thread name.
+namespace afu
+{
+
+	struct thread_config
+	{
+		std::string name;                        // shown by top / debuggers, Linux keeps 15 chars
+		std::vector<int> cpus;                   // allowed CPUs, empty keeps the inherited set
+		int fifo_priority = 0;                   // 1..99 runs the thread SCHED_FIFO, 0 keeps the default scheduler
+		std::chrono::nanoseconds spin_budget{ 0 };  // busy-poll this long for new work before sleeping
+	};
+
+	inline void cpu_relax() noexcept
+	{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+		_mm_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#else
+		std::this_thread::yield();
+#endif
+	}
+
+	// Polls _ready() until it returns true or _budget is spent
+	template<typename F>
+	bool spin_until(std::chrono::nanoseconds _budget, F&& _ready)
+	{
+		if (_budget <= std::chrono::nanoseconds::zero())
+			return false;
+
+		auto deadline = std::chrono::steady_clock::now() + _budget;
+		do
+		{
+			for (int i = 0; i < 64; ++i)
+			{
+				if (_ready())
+					return true;
+
+				cpu_relax();
+			}
+		} while (std::chrono::steady_clock::now() < deadline);
+
+		return false;
+	}
+
+	// One consumer sleeping until _ready() holds, any thread may unpark it. The parked
+	// flag and the caller's data form a Dekker pair : a producer publishes, then calls
+	// unpark(), which costs a fence and a load while nobody is parked.
+	class thread_parker
+	{
+	private:
+
+		std::atomic_bool m_parked{ false };
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+
+	public:
+
+		template<typename F>
+		void park(F&& _ready)
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_parked.store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (!_ready())
+				m_cv.wait(lock, [&]() { return !m_parked.load(); });
+
+			m_parked.store(false);
+		}
+
+		void unpark()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (!m_parked.load())
+				return;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_parked.store(false);
+			}
+			m_cv.notify_one();
+		}
+	};
+
+	// Runs an asio style io_context (poll / run_one / run / stopped). With a spin budget
+	// the thread busy-polls for completions before blocking in run_one().
+	template<typename IoContext>
+	void run_io_context(IoContext& _io_context, std::chrono::nanoseconds _spin_budget)
+	{
+		if (_spin_budget <= std::chrono::nanoseconds::zero())
+		{
+			_io_context.run();
+			return;
+		}
+
+		while (!_io_context.stopped())
+		{
+			if (_io_context.poll() > 0)
+				continue;
+
+			if (spin_until(_spin_budget, [&]() { return _io_context.poll() > 0 || _io_context.stopped(); }))
+				continue;
+
+			_io_context.run_one();
+		}
+	}
+
+	// Applies name, affinity and priority to the calling thread. Returns false when a
+	// setting was refused (SCHED_FIFO usually needs CAP_SYS_NICE); the others still apply.
+	inline bool apply_thread_config(const thread_config& _config)
+	{
+		bool ok = true;
+
+#if defined(__linux__)
+		auto self = pthread_self();
+
+		if (!_config.name.empty())
+			ok = pthread_setname_np(self, _config.name.substr(0, 15).c_str()) == 0 && ok;
+
+		if (!_config.cpus.empty())
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			for (auto cpu : _config.cpus)
+			{
+				if (cpu >= 0 && cpu < CPU_SETSIZE)
+					CPU_SET(cpu, &set);
+			}
+			ok = pthread_setaffinity_np(self, sizeof(set), &set) == 0 && ok;
+		}
+
+		if (_config.fifo_priority > 0)
+		{
+			sched_param param{};
+			param.sched_priority = _config.fifo_priority;
+			ok = pthread_setschedparam(self, SCHED_FIFO, &param) == 0 && ok;
+		}
+#elif defined(_WIN32)
+		auto self = GetCurrentThread();
+
+		if (!_config.name.empty())
+		{
+			std::wstring name(_config.name.begin(), _config.name.end());
+			ok = SUCCEEDED(SetThreadDescription(self, name.c_str())) && ok;
+		}
+
+		if (!_config.cpus.empty())
+		{
+			DWORD_PTR mask = 0;
+			for (auto cpu : _config.cpus)
+			{
+				if (cpu >= 0 && cpu < static_cast<int>(sizeof(DWORD_PTR) * 8))
+					mask |= DWORD_PTR(1) << cpu;
+			}
+			ok = SetThreadAffinityMask(self, mask) != 0 && ok;
+		}
+
+		if (_config.fifo_priority > 0)
+			ok = SetThreadPriority(self, THREAD_PRIORITY_TIME_CRITICAL) != 0 && ok;
+#else
+		ok = _config.name.empty() && _config.cpus.empty() && _config.fifo_priority == 0;
+#endif
+
+		return ok;
+	}
+
+	// Same settings for one of several threads, the name gets the _index suffix
+	inline thread_config indexed_thread_config(const thread_config& _config, size_t _index)
+	{
+		auto config = _config;
+		if (!config.name.empty())
+			config.name += "-" + std::to_string(_index);
+
+		return config;
+	}
+
+}
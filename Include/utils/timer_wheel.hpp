@@ -0,0 +1,353 @@
+#pragma once
+// Schwartz Liran
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+
+// Timer wheel : hierarchical timing wheel, 4 levels of 64 slots.
+// Insert and cancel are O(1), advancing skips empty slots through per-level bitmaps.
+// Not thread safe, it belongs to one thread (the dispatcher worker). Cancellation
+// goes through timer_handle and may happen from any thread.
+namespace afu
+{
+
+	class timer_handle
+	{
+	private:
+
+		std::shared_ptr<std::atomic_bool> m_cancelled;
+
+	public:
+
+		timer_handle() = default;
+
+		explicit timer_handle(std::shared_ptr<std::atomic_bool> _cancelled) :
+			m_cancelled(std::move(_cancelled))
+		{}
+
+		// The timer will not fire any more, a periodic one stops
+		void cancel()
+		{
+			if (m_cancelled != nullptr)
+				m_cancelled->store(true, std::memory_order_release);
+		}
+
+		bool is_cancelled() const
+		{
+			return m_cancelled == nullptr || m_cancelled->load(std::memory_order_acquire);
+		}
+
+		bool valid() const noexcept
+		{
+			return m_cancelled != nullptr;
+		}
+	};
+
+
+	template<typename Callback>
+	class timer_wheel
+	{
+	public:
+
+		using clock = std::chrono::steady_clock;
+
+		static constexpr size_t LEVELS = 4;
+		static constexpr size_t SLOT_BITS = 6;
+		static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+		static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+		static constexpr uint64_t NO_TICK = std::numeric_limits<uint64_t>::max();
+
+	private:
+
+		struct timer_node
+		{
+			uint64_t m_deadline;  // absolute tick
+			uint64_t m_period;    // ticks, 0 for one shot
+			std::shared_ptr<std::atomic_bool> m_cancelled;
+			Callback m_callback;
+			timer_node* m_next;
+		};
+
+		std::array<std::array<timer_node*, SLOTS>, LEVELS> m_slots{};
+		std::array<uint64_t, LEVELS> m_bitmap{};
+		timer_node* m_expired = nullptr;  // due at insert time
+
+		clock::duration m_tick;
+		clock::time_point m_origin;
+		uint64_t m_current = 0;
+		size_t m_count = 0;
+
+	public:
+
+		explicit timer_wheel(clock::duration _tick = std::chrono::microseconds(100)) :
+			m_tick(_tick.count() > 0 ? _tick : clock::duration(1)),
+			m_origin(clock::now())
+		{}
+
+		timer_wheel(const timer_wheel& other) = delete;
+
+		~timer_wheel()
+		{
+			release(m_expired);
+			for (auto& level : m_slots)
+				for (auto head : level)
+					release(head);
+		}
+
+		// _period == 0 for a one shot timer
+		timer_handle add(clock::time_point _deadline, clock::duration _period, Callback _callback)
+		{
+			auto cancelled = std::make_shared<std::atomic_bool>(false);
+			add(_deadline, _period, std::move(_callback), cancelled);
+			return timer_handle(cancelled);
+		}
+
+		// For handles created on another thread before the timer reaches the wheel
+		void add(clock::time_point _deadline, clock::duration _period, Callback _callback, std::shared_ptr<std::atomic_bool> _cancelled)
+		{
+			auto node = new timer_node{ to_tick(_deadline), period_ticks(_period), std::move(_cancelled), std::move(_callback), nullptr };
+			insert(node);
+			++m_count;
+		}
+
+		bool empty() const noexcept
+		{
+			return m_count == 0;
+		}
+
+		// timers still in the wheel, cancelled ones included until their slot comes up
+		size_t size() const noexcept
+		{
+			return m_count;
+		}
+
+		// Earliest point at which advance() may have something to do
+		clock::time_point next_deadline() const
+		{
+			auto tick = next_tick();
+			if (tick == NO_TICK)
+				return clock::time_point::max();
+
+			return m_origin + m_tick * static_cast<clock::rep>(tick);
+		}
+
+		// Fires every timer due at _now through _fire(Callback&), re-arms periodic ones
+		template<typename F>
+		void advance(clock::time_point _now, F&& _fire)
+		{
+			auto target = to_tick_floor(_now);
+
+			fire_list(detach(m_expired), _fire);
+
+			while (true)
+			{
+				auto next = next_tick();
+				if (next == NO_TICK || next > target)
+				{
+					if (target > m_current)
+						m_current = target;
+					return;
+				}
+
+				if (next > m_current)
+					m_current = next;
+
+				cascade();
+
+				auto index = m_current & SLOT_MASK;
+				auto due = m_slots[0][index];
+				m_slots[0][index] = nullptr;
+				m_bitmap[0] &= ~(uint64_t(1) << index);
+				fire_list(due, _fire);
+				fire_list(detach(m_expired), _fire);
+
+				if (m_current >= target)
+					return;
+			}
+		}
+
+	private:
+
+		uint64_t to_tick(clock::time_point _time) const
+		{
+			if (_time <= m_origin)
+				return 0;
+
+			// round up, a timer never fires early
+			auto elapsed = _time - m_origin;
+			return static_cast<uint64_t>((elapsed + m_tick - clock::duration(1)) / m_tick);
+		}
+
+		uint64_t to_tick_floor(clock::time_point _time) const
+		{
+			if (_time <= m_origin)
+				return 0;
+
+			return static_cast<uint64_t>((_time - m_origin) / m_tick);
+		}
+
+		uint64_t period_ticks(clock::duration _period) const
+		{
+			if (_period.count() <= 0)
+				return 0;
+
+			auto ticks = static_cast<uint64_t>((_period + m_tick - clock::duration(1)) / m_tick);
+			return ticks == 0 ? 1 : ticks;
+		}
+
+		void insert(timer_node* _node)
+		{
+			if (_node->m_deadline <= m_current)
+			{
+				_node->m_next = m_expired;
+				m_expired = _node;
+				return;
+			}
+
+			auto delta = _node->m_deadline - m_current;
+			size_t level = 0;
+			while (level + 1 < LEVELS && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+				++level;
+
+			auto shift = SLOT_BITS * level;
+			uint64_t index;
+			if (delta >= (uint64_t(1) << (SLOT_BITS * LEVELS)))
+				index = ((m_current >> shift) + SLOT_MASK) & SLOT_MASK;  // beyond range, parked in the furthest slot
+			else
+				index = (_node->m_deadline >> shift) & SLOT_MASK;
+
+			_node->m_next = m_slots[level][index];
+			m_slots[level][index] = _node;
+			m_bitmap[level] |= uint64_t(1) << index;
+		}
+
+		// Moves the higher level slots that start at m_current down the wheel
+		void cascade()
+		{
+			for (size_t level = 1; level < LEVELS; ++level)
+			{
+				auto lower_shift = SLOT_BITS * level;
+				if ((m_current & ((uint64_t(1) << lower_shift) - 1)) != 0)
+					return;
+
+				auto index = (m_current >> lower_shift) & SLOT_MASK;
+				auto list = m_slots[level][index];
+				m_slots[level][index] = nullptr;
+				m_bitmap[level] &= ~(uint64_t(1) << index);
+
+				while (list != nullptr)
+				{
+					auto next = list->m_next;
+					insert(list);
+					list = next;
+				}
+			}
+		}
+
+		uint64_t next_tick() const
+		{
+			if (m_count == 0)
+				return NO_TICK;
+
+			if (m_expired != nullptr)
+				return m_current;
+
+			uint64_t best = NO_TICK;
+			for (size_t level = 0; level < LEVELS; ++level)
+			{
+				if (m_bitmap[level] == 0)
+					continue;
+
+				auto shift = SLOT_BITS * level;
+				auto rotation_shift = shift + SLOT_BITS;
+				auto index = (m_current >> shift) & SLOT_MASK;
+				auto rotation_start = (m_current >> rotation_shift) << rotation_shift;
+
+				// level 0 includes the current slot, higher levels were cascaded already
+				auto ahead = level == 0 ? m_bitmap[level] >> index : (index == SLOT_MASK ? 0 : m_bitmap[level] >> (index + 1));
+				uint64_t tick;
+				if (ahead != 0)
+				{
+					auto first = (level == 0 ? index : index + 1) + lowest_bit(ahead);
+					tick = rotation_start + (first << shift);
+				}
+				else
+				{
+					// only slots of the next rotation left, its start is a safe lower bound
+					tick = rotation_start + (uint64_t(1) << rotation_shift);
+				}
+
+				if (tick < best)
+					best = tick;
+			}
+			return best;
+		}
+
+		static uint64_t lowest_bit(uint64_t _bits)
+		{
+			uint64_t index = 0;
+			while ((_bits & 1) == 0)
+			{
+				_bits >>= 1;
+				++index;
+			}
+			return index;
+		}
+
+		static timer_node* detach(timer_node*& _list)
+		{
+			auto list = _list;
+			_list = nullptr;
+			return list;
+		}
+
+		template<typename F>
+		void fire_list(timer_node* _list, F& _fire)
+		{
+			while (_list != nullptr)
+			{
+				auto node = _list;
+				_list = _list->m_next;
+
+				if (node->m_cancelled->load(std::memory_order_acquire))
+				{
+					--m_count;
+					delete node;
+					continue;
+				}
+
+				_fire(node->m_callback);
+
+				if (node->m_period == 0 || node->m_cancelled->load(std::memory_order_acquire))
+				{
+					--m_count;
+					delete node;
+					continue;
+				}
+
+				// drift free, missed periods are skipped rather than fired in a burst
+				node->m_deadline += node->m_period;
+				if (node->m_deadline <= m_current)
+					node->m_deadline += ((m_current - node->m_deadline) / node->m_period + 1) * node->m_period;
+
+				insert(node);
+			}
+		}
+
+		static void release(timer_node* _list)
+		{
+			while (_list != nullptr)
+			{
+				auto next = _list->m_next;
+				delete _list;
+				_list = next;
+			}
+		}
+	};
+
+}
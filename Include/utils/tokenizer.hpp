@@ -0,0 +1,302 @@
+#pragma once
+// Schwartz Liran
+
+#include <charconv>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define AFU_TOKENIZER_SSE2 1
+#else
+#define AFU_TOKENIZER_SSE2 0
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Tokenizer : allocation free splitting of text into string_view fields.
+// Delimiters are searched 32 (AVX2, when the build enables it) or 16 (SSE2) bytes at a
+// time, with a scalar loop for the tail and other targets. Tokens point into the
+// original text, which must outlive them.
+namespace afu
+{
+
+	namespace detail
+	{
+		inline unsigned lowest_bit(unsigned _mask) noexcept
+		{
+#if defined(_MSC_VER) && !defined(__clang__)
+			unsigned long index;
+			_BitScanForward(&index, _mask);
+			return static_cast<unsigned>(index);
+#else
+			return static_cast<unsigned>(__builtin_ctz(_mask));
+#endif
+		}
+
+		// First _char in [_begin, _end), or _end
+		inline const char* find_char(const char* _begin, const char* _end, char _char) noexcept
+		{
+			auto p = _begin;
+#if defined(__AVX2__)
+			auto needle32 = _mm256_set1_epi8(_char);
+			while (_end - p >= 32)
+			{
+				auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+				auto mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle32)));
+				if (mask != 0)
+					return p + lowest_bit(mask);
+
+				p += 32;
+			}
+#endif
+#if AFU_TOKENIZER_SSE2
+			auto needle16 = _mm_set1_epi8(_char);
+			while (_end - p >= 16)
+			{
+				auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+				auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16)));
+				if (mask != 0)
+					return p + lowest_bit(mask);
+
+				p += 16;
+			}
+#endif
+			while (p < _end && *p != _char)
+				++p;
+
+			return p;
+		}
+
+		// First occurrence of _delimiter in [_begin, _end), or _end
+		inline const char* find_delimiter(const char* _begin, const char* _end, std::string_view _delimiter) noexcept
+		{
+			if (_delimiter.size() == 1)
+				return find_char(_begin, _end, _delimiter[0]);
+
+			auto p = _begin;
+			while (static_cast<size_t>(_end - p) >= _delimiter.size())
+			{
+				p = find_char(p, _end - _delimiter.size() + 1, _delimiter[0]);
+				if (static_cast<size_t>(_end - p) < _delimiter.size())
+					break;
+
+				if (std::memcmp(p + 1, _delimiter.data() + 1, _delimiter.size() - 1) == 0)
+					return p;
+
+				++p;
+			}
+			return _end;
+		}
+	}
+
+
+	// Splits on every delimiter : "a,,b," gives "a", "", "b", "". Empty text gives no
+	// token. With _skip_empty, runs of delimiters count as one ("a  b" on ' ').
+	class tokenizer
+	{
+	private:
+
+		std::string_view m_text;
+		std::string_view m_delimiter;
+		char m_single;  // storage when built from a char
+		bool m_skip_empty;
+
+	public:
+
+		class iterator
+		{
+		private:
+
+			const tokenizer* m_owner = nullptr;
+			const char* m_next = nullptr;  // start of the following token, nullptr after the last one
+			std::string_view m_token;
+			bool m_done = true;
+
+			void advance()
+			{
+				auto end = m_owner->m_text.data() + m_owner->m_text.size();
+				do
+				{
+					if (m_next == nullptr)
+					{
+						m_done = true;
+						return;
+					}
+
+					auto found = detail::find_delimiter(m_next, end, m_owner->delimiter());
+					m_token = std::string_view(m_next, static_cast<size_t>(found - m_next));
+					m_next = found == end ? nullptr : found + m_owner->delimiter().size();
+				} while (m_token.empty() && m_owner->m_skip_empty);
+			}
+
+		public:
+
+			using iterator_category = std::input_iterator_tag;
+			using value_type = std::string_view;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const std::string_view*;
+			using reference = const std::string_view&;
+
+			iterator() = default;
+
+			explicit iterator(const tokenizer* _owner) :
+				m_owner(_owner),
+				m_next(_owner->m_text.empty() ? nullptr : _owner->m_text.data()),
+				m_done(false)
+			{
+				advance();
+			}
+
+			reference operator*() const noexcept { return m_token; }
+
+			pointer operator->() const noexcept { return &m_token; }
+
+			iterator& operator++()
+			{
+				advance();
+				return *this;
+			}
+
+			iterator operator++(int)
+			{
+				auto copy = *this;
+				advance();
+				return copy;
+			}
+
+			bool operator==(const iterator& other) const noexcept
+			{
+				if (m_done || other.m_done)
+					return m_done == other.m_done;
+
+				return m_token.data() == other.m_token.data() && m_token.size() == other.m_token.size();
+			}
+
+			bool operator!=(const iterator& other) const noexcept
+			{
+				return !(*this == other);
+			}
+		};
+
+		tokenizer(std::string_view _text, char _delimiter, bool _skip_empty = false) :
+			m_text(_text),
+			m_single(_delimiter),
+			m_skip_empty(_skip_empty)
+		{}
+
+		// Multi-character delimiter, e.g. ", " or "\r\n"
+		tokenizer(std::string_view _text, std::string_view _delimiter, bool _skip_empty = false) :
+			m_text(_text),
+			m_delimiter(_delimiter),
+			m_single(0),
+			m_skip_empty(_skip_empty)
+		{
+			if (_delimiter.empty())
+				throw std::invalid_argument("tokenizer delimiter is empty");
+		}
+
+		std::string_view delimiter() const noexcept
+		{
+			return m_delimiter.empty() ? std::string_view(&m_single, 1) : m_delimiter;
+		}
+
+		iterator begin() const
+		{
+			return iterator(this);
+		}
+
+		iterator end() const
+		{
+			return iterator();
+		}
+
+		// Writes up to _max tokens to _out and returns how many. Stops early when _out is
+		// full, call count() first to size the buffer when that matters.
+		size_t split_into(std::string_view* _out, size_t _max) const
+		{
+			size_t count = 0;
+			for (auto it = begin(); it != end() && count < _max; ++it)
+				_out[count++] = *it;
+
+			return count;
+		}
+
+		size_t count() const
+		{
+			size_t count = 0;
+			for (auto it = begin(); it != end(); ++it)
+				++count;
+
+			return count;
+		}
+	};
+
+
+	// Parses the whole of _text as a number (decimal, an optional leading '+' or '-').
+	// Returns false and leaves _value untouched when _text is not exactly one number.
+	template<typename T>
+	bool parse_number(std::string_view _text, T& _value)
+	{
+		static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value, "parse_number needs a number type");
+
+		if (!_text.empty() && _text.front() == '+')
+		{
+			_text.remove_prefix(1);
+			if (!_text.empty() && _text.front() == '-')
+				return false;
+		}
+
+		if (_text.empty())
+			return false;
+
+		auto end = _text.data() + _text.size();
+#if defined(__cpp_lib_to_chars)
+		T parsed{};
+		auto res = std::from_chars(_text.data(), end, parsed);
+		if (res.ec != std::errc() || res.ptr != end)
+			return false;
+
+		_value = parsed;
+		return true;
+#else
+		if constexpr (std::is_integral<T>::value)
+		{
+			T parsed{};
+			auto res = std::from_chars(_text.data(), end, parsed);
+			if (res.ec != std::errc() || res.ptr != end)
+				return false;
+
+			_value = parsed;
+			return true;
+		}
+		else
+		{
+			// no floating point from_chars in this standard library
+			char buffer[64];
+			if (_text.size() >= sizeof(buffer))
+				return false;
+
+			std::memcpy(buffer, _text.data(), _text.size());
+			buffer[_text.size()] = '\0';
+			char* parsed_end = nullptr;
+			auto parsed = std::strtod(buffer, &parsed_end);
+			if (parsed_end != buffer + _text.size())
+				return false;
+
+			_value = static_cast<T>(parsed);
+			return true;
+		}
+#endif
+	}
+
+}